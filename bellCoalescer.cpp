@@ -0,0 +1,89 @@
+/*
+ *  bellCoalescer.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "bellCoalescer.h"
+#include <iterator>
+
+const char kCoalescerStatisticsFormat[] = "Bell coalescer: %zu pending groups, %zu bells merged\n";
+
+BellCoalescer::BellCoalescer(int window, size_t max_count)
+: window_(window), max_count_(max_count), merged_(0) {}
+
+std::string BellCoalescer::KeyForEvent(const BellEvent& event) {
+  // Fields are separated by a character that cannot appear in any of them.
+  std::string key = event.displayName();
+  key.push_back('\0');
+  key.append(std::to_string(event.window()));
+  key.push_back('\0');
+  key.append(event.name());
+  key.push_back('\0');
+  key.append(event.hostName());
+  return key;
+}
+
+void BellCoalescer::Release(GroupList::iterator group, std::vector<CoalescedBell>* ready) {
+  index_.erase(group->key);
+  if (group->bell.count > 0) {
+    ready->push_back(std::move(group->bell));
+  }
+  groups_.erase(group);
+}
+
+void BellCoalescer::Add(CoalescedBell bell, Clock::time_point now,
+                        std::vector<CoalescedBell>* ready) {
+  if (window_.count() <= 0) {
+    ready->push_back(std::move(bell));
+    return;
+  }
+  std::string key = KeyForEvent(*bell.event);
+  auto found = index_.find(key);
+  if (found == index_.end()) {
+    // The first bell goes out at once, the group waits for repeats.
+    Group group = { key, now + window_, { nullptr, 0 } };
+    groups_.push_back(std::move(group));
+    index_[key] = std::prev(groups_.end());
+    ready->push_back(std::move(bell));
+    return;
+  }
+  GroupList::iterator group = found->second;
+  if (group->bell.count == 0) {
+    group->bell = std::move(bell);
+  } else {
+    group->bell.count += bell.count;
+    merged_ += bell.count;
+  }
+  if (max_count_ > 0 && group->bell.count >= max_count_) {
+    Release(group, ready);
+  }
+}
+
+void BellCoalescer::Flush(Clock::time_point now, std::vector<CoalescedBell>* ready) {
+  while (!groups_.empty() && groups_.front().deadline <= now) {
+    Release(groups_.begin(), ready);
+  }
+}
+
+int BellCoalescer::NextTimeout(Clock::time_point now, int max_timeout) const {
+  if (groups_.empty()) {
+    return max_timeout;
+  }
+  const Clock::time_point deadline = groups_.front().deadline;
+  if (deadline <= now) {
+    return 0;
+  }
+  // Round up, so that the group has closed when the wait ends.
+  const long long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - now + std::chrono::milliseconds(1) - Clock::duration(1)).count();
+  return remaining < max_timeout ? static_cast<int>(remaining) : max_timeout;
+}
+
+void BellCoalescer::PrintStatistics(FILE* file) const {
+  fprintf(file, kCoalescerStatisticsFormat, groups_.size(), merged_);
+}
@@ -0,0 +1,76 @@
+/*
+ *  bellCoalescer.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_BELL_COALESCER
+#define XKBGROWL_BELL_COALESCER
+#include <chrono>
+#include <list>
+#include <memory>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "x11Util.h"
+
+// A bell event standing for count identical bells.
+struct CoalescedBell {
+  std::unique_ptr<BellEvent> event;  // First of the bells.
+  size_t count;
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Merges bells with the same name, window, host and display. The first bell
+// is released at once, so a lone bell is never delayed; it opens a time
+// window in which the repeats are merged into a single counted notification.
+// The repeats are released when the window closes or as soon as they are
+// max_count bells, so a runaway client produces a steady trickle of
+// notifications instead of a flood.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class BellCoalescer {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  // A window of 0 ms disables coalescing, every bell is released immediately.
+  BellCoalescer(int window, size_t max_count);
+  // Adds bell, that may already stand for several bells, appends it to ready
+  // if it opens a group, and the groups that are complete.
+  void Add(CoalescedBell bell, Clock::time_point now, std::vector<CoalescedBell>* ready);
+  // Appends the groups whose window closed before now to ready, if they
+  // merged any repeat.
+  void Flush(Clock::time_point now, std::vector<CoalescedBell>* ready);
+  // Milliseconds until the next group closes, capped at max_timeout.
+  int NextTimeout(Clock::time_point now, int max_timeout) const;
+
+  size_t pending() const { return groups_.size(); }
+  size_t merged() const { return merged_; }
+  void PrintStatistics(FILE* file) const;
+  // Bells with the same key are merged.
+  static std::string KeyForEvent(const BellEvent& event);
+private:
+  struct Group {
+    std::string key;
+    Clock::time_point deadline;
+    CoalescedBell bell;  // The repeats, the event is null until there is one.
+  };
+  // Groups ordered by creation, hence by deadline.
+  typedef std::list<Group> GroupList;
+  void Release(GroupList::iterator group, std::vector<CoalescedBell>* ready);
+
+  const std::chrono::milliseconds window_;
+  const size_t max_count_;
+  size_t merged_;  // Repeats folded into an earlier one.
+  GroupList groups_;
+  std::unordered_map<std::string, GroupList::iterator> index_;
+};
+
+#endif
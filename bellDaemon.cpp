@@ -0,0 +1,109 @@
+/*
+ *  bellDaemon.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "bellDaemon.h"
+#include <signal.h>
+#include <stdio.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bellCoalescer.h"
+#include "bellQueue.h"
+
+// Maximum time, in milliseconds, the main loop waits for a bell.
+const int kEventTimeout = 1000;
+// Maximum number of events read from the display in one go.
+const size_t kMaxBatchSize = 64;
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Statistics are printed on stderr when SIGUSR1 is received.
+// ─────────────────────────────────────────────────────────────────────────────
+
+static volatile sig_atomic_t statisticsRequested = 0;
+
+static void RequestStatistics(int /*signal*/) {
+  statisticsRequested = 1;
+}
+
+void RunBellDaemon(DisplayMultiplexer* displays, const BellDaemonOptions& options,
+                   NotificationDispatcher* dispatcher) {
+  signal(SIGUSR1, RequestStatistics);
+  // Sinks report vanished readers through write errors.
+  signal(SIGPIPE, SIG_IGN);
+
+  // The reader thread owns the X11 connections: it drains them and resolves
+  // the window attributes of each event. Resolved events are passed through
+  // a bounded queue; unless the policy is to block, a slow sink never stops
+  // the connections from being read, bells are dropped or merged instead.
+  BellQueue queue(options.queue_capacity, options.overload_policy, options.priority_aging);
+  // Flooding clients are limited before their windows are even looked at.
+  BellRateLimiter limiter(options.window_limit, options.name_limit, options.host_limit,
+                          options.digest_interval);
+  if (limiter.enabled()) {
+    displays->SetRateLimiter(&limiter);
+  }
+  // Set by the reader thread once every display is lost, after its last push.
+  std::atomic<bool> finished(false);
+  std::thread reader([displays, &queue, &limiter, &finished]() {
+    std::vector<std::unique_ptr<BellEvent> > events;
+    while (displays->size() > 0) {
+      events.clear();
+      displays->NextBellEvents(kMaxBatchSize, kEventTimeout, &events);
+      BellEvent* const digest = limiter.Digest(BellRateLimiter::Clock::now());
+      if (digest != nullptr) {
+        events.push_back(std::unique_ptr<BellEvent>(digest));
+      }
+      for (size_t i = 0; i < events.size(); ++i) {
+        CoalescedBell bell = { std::move(events[i]), 1 };
+        queue.Push(std::move(bell));
+      }
+    }
+    finished = true;
+  });
+
+  // Identical bells are merged before any icon is converted.
+  BellCoalescer coalescer(options.coalesce_window, options.coalesce_limit);
+  std::vector<CoalescedBell> ready;
+  while(true) {
+    // Wake up when the oldest group of merged bells is due, and at least every
+    // kEventTimeout ms to handle statistics requests: a signal does not
+    // interrupt the wait on the queue.
+    const int timeout = coalescer.NextTimeout(BellCoalescer::Clock::now(), kEventTimeout);
+    // Read before the queue: once the reader is done, an empty queue stays so.
+    const bool done = finished;
+    CoalescedBell bell;
+    if (queue.Pop(&bell, timeout)) {
+      coalescer.Add(std::move(bell), BellCoalescer::Clock::now(), &ready);
+    } else if (done) {
+      break;
+    }
+    coalescer.Flush(BellCoalescer::Clock::now(), &ready);
+    for (size_t i = 0; i < ready.size(); ++i) {
+      dispatcher->Post(std::move(ready[i].event), ready[i].count);
+    }
+    ready.clear();
+    if (statisticsRequested) {
+      statisticsRequested = 0;
+      displays->PrintStatistics(stderr);
+      queue.PrintStatistics(stderr);
+      limiter.PrintStatistics(stderr);
+      coalescer.PrintStatistics(stderr);
+      dispatcher->PrintStatistics(stderr);
+    }
+  }
+  // The groups still open are posted without waiting for their window to close.
+  coalescer.Flush(BellCoalescer::Clock::time_point::max(), &ready);
+  for (size_t i = 0; i < ready.size(); ++i) {
+    dispatcher->Post(std::move(ready[i].event), ready[i].count);
+  }
+  reader.join();
+}
@@ -0,0 +1,50 @@
+/*
+ *  bellDaemon.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_BELL_DAEMON
+#define XKBGROWL_BELL_DAEMON
+
+#include <stddef.h>
+
+#include "bellQueue.h"
+#include "displayMultiplexer.h"
+#include "notificationSink.h"
+#include "rateLimiter.h"
+
+// Default time window, in milliseconds, during which identical bells are merged.
+const int kDefaultCoalesceWindow = 200;
+// Default number of merged bells after which a notification is sent anyway.
+const size_t kDefaultCoalesceLimit = 100;
+// Default number of resolved bells that can wait for the dispatch thread.
+const size_t kDefaultQueueCapacity = 1024;
+const OverloadPolicy kDefaultOverloadPolicy = kCoalescePolicy;
+
+struct BellDaemonOptions {
+  int coalesce_window;    // Milliseconds, 0 disables coalescing.
+  size_t coalesce_limit;  // 0 means no limit.
+  size_t queue_capacity;
+  OverloadPolicy overload_policy;  // What to do when the queue is full.
+  int priority_aging;      // Milliseconds, 0 pops queued bells in order.
+  RateLimit window_limit;  // Bells per window.
+  RateLimit name_limit;    // Bells per bell name.
+  RateLimit host_limit;    // Bells per client host.
+  int digest_interval;     // Milliseconds between digests of suppressed bells.
+};
+
+// Main loop of the daemon, returns once the connection to every display is
+// lost and the bells already read are handed over. A reader thread drains the
+// displays and resolves the window attributes of each bell; the calling
+// thread merges identical bells and hands them to dispatcher, whose workers
+// post them.
+// Statistics are printed on stderr when SIGUSR1 is received.
+void RunBellDaemon(DisplayMultiplexer* displays, const BellDaemonOptions& options,
+                   NotificationDispatcher* dispatcher);
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ *  bellQueue.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "bellQueue.h"
+#include <algorithm>
+
+const char kQueueStatisticsFormat[] =
+    "Dispatch queue (%s): depth %zu, high water %zu, capacity %zu, %zu dropped, %zu coalesced, "
+    "%zu promoted\n";
+// BellFeedbackClass of the X input extension, keyboard bells use KbdFeedbackClass.
+const int kBellFeedbackClass = 5;
+// Priorities added to bells rung on a bell feedback.
+const int kBellFeedbackBoost = 5;
+const char* const kOverloadPolicyNames[] = { "block", "drop-oldest", "drop-newest", "coalesce" };
+
+const char* OverloadPolicyName(OverloadPolicy policy) {
+  return kOverloadPolicyNames[policy];
+}
+
+bool ParseOverloadPolicy(const std::string& name, OverloadPolicy* policy) {
+  for (int i = kBlockPolicy; i <= kCoalescePolicy; ++i) {
+    if (name == kOverloadPolicyNames[i]) {
+      *policy = static_cast<OverloadPolicy>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+int BellPriority(const BellEvent& event) {
+  const int volume = std::min(std::max(event.percent(), 0), 100) / 10;
+  return volume + (event.bellClass() == kBellFeedbackClass ? kBellFeedbackBoost : 0);
+}
+
+BellQueue::BellQueue(size_t capacity, OverloadPolicy policy, int aging)
+: capacity_(capacity > 0 ? capacity : 1), policy_(policy),
+  aging_(std::chrono::milliseconds(std::max(aging, 0))), priorities_(kBellPriorities),
+  high_water_(0), dropped_(0), coalesced_(0), promoted_(0) {}
+
+BellQueue::EntryList::iterator BellQueue::Next(Clock::time_point now) {
+  if (aging_.count() == 0) {
+    return entries_.begin();
+  }
+  // Within a priority the oldest entry ages most, so only the first entry of
+  // each priority is a candidate.
+  EntryList::iterator best = entries_.end();
+  long long best_priority = -1;
+  for (int priority = 0; priority < kBellPriorities; ++priority) {
+    if (priorities_[priority].empty()) {
+      continue;
+    }
+    const EntryList::iterator candidate = priorities_[priority].front();
+    const long long effective = priority + (now - candidate->queued) / aging_;
+    if (effective > best_priority ||
+        (effective == best_priority && candidate->queued < best->queued)) {
+      best = candidate;
+      best_priority = effective;
+    }
+  }
+  return best;
+}
+
+void BellQueue::Remove(EntryList::iterator entry, CoalescedBell* bell) {
+  priorities_[entry->priority].pop_front();
+  if (!entry->key.empty()) {
+    auto found = index_.find(entry->key);
+    if (found != index_.end() && found->second == entry) {
+      index_.erase(found);
+    }
+  }
+  *bell = std::move(entry->bell);
+  entries_.erase(entry);
+}
+
+void BellQueue::Push(CoalescedBell bell) {
+  Entry entry;
+  // The key is computed before taking the lock, it costs a few allocations.
+  if (policy_ == kCoalescePolicy) {
+    entry.key = BellCoalescer::KeyForEvent(*bell.event);
+  }
+  entry.priority = aging_.count() > 0 ? BellPriority(*bell.event) : 0;
+  entry.queued = Clock::now();
+  entry.bell = std::move(bell);
+  // Dropped bells are destroyed once the lock is released.
+  CoalescedBell discarded;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (entries_.size() >= capacity_) {
+      switch (policy_) {
+        case kBlockPolicy:
+          while (entries_.size() >= capacity_) {
+            not_full_.wait(lock);
+          }
+          break;
+        case kDropNewestPolicy:
+          dropped_ += entry.bell.count;
+          discarded = std::move(entry.bell);
+          return;
+        case kCoalescePolicy: {
+          auto found = index_.find(entry.key);
+          if (found != index_.end()) {
+            found->second->bell.count += entry.bell.count;
+            coalesced_ += entry.bell.count;
+            discarded = std::move(entry.bell);
+            return;
+          }
+        }
+          // No bell from the same source, fall through.
+        case kDropOldestPolicy:
+          Remove(entries_.begin(), &discarded);
+          dropped_ += discarded.count;
+          break;
+      }
+    }
+    entries_.push_back(std::move(entry));
+    const EntryList::iterator added = std::prev(entries_.end());
+    priorities_[added->priority].push_back(added);
+    if (!added->key.empty()) {
+      index_[added->key] = added;
+    }
+    if (entries_.size() > high_water_) {
+      high_water_ = entries_.size();
+    }
+  }
+  not_empty_.notify_one();
+}
+
+bool BellQueue::Pop(CoalescedBell* bell, int timeout) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    while (entries_.empty()) {
+      if (not_empty_.wait_until(lock, deadline) == std::cv_status::timeout &&
+          entries_.empty()) {
+        return false;
+      }
+    }
+    const EntryList::iterator next = Next(Clock::now());
+    if (next != entries_.begin()) {
+      ++promoted_;
+    }
+    Remove(next, bell);
+  }
+  not_full_.notify_one();
+  return true;
+}
+
+size_t BellQueue::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+size_t BellQueue::high_water() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return high_water_;
+}
+
+size_t BellQueue::dropped() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_;
+}
+
+size_t BellQueue::coalesced() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return coalesced_;
+}
+
+size_t BellQueue::promoted() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return promoted_;
+}
+
+void BellQueue::PrintStatistics(FILE* file) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  fprintf(file, kQueueStatisticsFormat, OverloadPolicyName(policy_), entries_.size(), high_water_,
+          capacity_, dropped_, coalesced_, promoted_);
+}
@@ -0,0 +1,110 @@
+/*
+ *  bellQueue.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_BELL_QUEUE
+#define XKBGROWL_BELL_QUEUE
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bellCoalescer.h"
+
+// What a full queue does with a new bell.
+enum OverloadPolicy {
+  kBlockPolicy,       // The producer waits for room.
+  kDropOldestPolicy,  // The oldest queued bell is discarded.
+  kDropNewestPolicy,  // The new bell is discarded.
+  kCoalescePolicy,    // The new bell is counted in a queued one from the same
+                      // source, if there is none the oldest is discarded.
+};
+
+const char* OverloadPolicyName(OverloadPolicy policy);
+// Returns false if name is not the name of a policy.
+bool ParseOverloadPolicy(const std::string& name, OverloadPolicy* policy);
+
+// Scheduling priority of a bell, between 0 and kBellPriorities - 1: its volume
+// in steps of 10 %, raised for bells rung on a bell feedback rather than on
+// the keyboard one.
+int BellPriority(const BellEvent& event);
+const int kBellPriorities = 16;
+
+// Default time, in milliseconds, after which a waiting bell gains a priority.
+const int kDefaultPriorityAging = 100;
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Bounded queue of bells between threads. Memory, and the time a bell waits,
+// are bounded by the capacity: when the queue is full the overload policy
+// decides which bells are lost. Lost and merged bells are counted.
+// When bells back up, the loudest are popped first. So that quiet bells are
+// not starved, a bell gains one priority for every aging ms it waits; among
+// bells of the same effective priority the oldest is popped first.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class BellQueue {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  // An aging of 0 disables priorities, bells are popped in order.
+  BellQueue(size_t capacity, OverloadPolicy policy, int aging);
+
+  // Queues bell, applying the overload policy if the queue is full.
+  void Push(CoalescedBell bell);
+  // Waits at most timeout ms for a bell, returns false on timeout.
+  bool Pop(CoalescedBell* bell, int timeout);
+
+  size_t size() const;
+  size_t capacity() const { return capacity_; }
+  size_t high_water() const;
+  // Number of bells discarded, and folded into a queued bell.
+  size_t dropped() const;
+  size_t coalesced() const;
+  // Number of bells popped before an older one.
+  size_t promoted() const;
+  void PrintStatistics(FILE* file) const;
+private:
+  BellQueue(const BellQueue&);
+  BellQueue& operator=(const BellQueue&);
+  struct Entry {
+    std::string key;  // Source of the bell, only set by kCoalescePolicy.
+    CoalescedBell bell;
+    int priority;
+    Clock::time_point queued;
+  };
+  typedef std::list<Entry> EntryList;
+  // Entry to pop next.
+  EntryList::iterator Next(Clock::time_point now);
+  // Removes entry, which is the oldest of its priority, returns it in bell.
+  void Remove(EntryList::iterator entry, CoalescedBell* bell);
+
+  const size_t capacity_;
+  const OverloadPolicy policy_;
+  const Clock::duration aging_;
+  mutable std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  EntryList entries_;  // In arrival order.
+  // Entries of each priority, in arrival order.
+  std::vector<std::deque<EntryList::iterator> > priorities_;
+  // Most recent entry of each source.
+  std::unordered_map<std::string, EntryList::iterator> index_;
+  size_t high_water_;
+  size_t dropped_;
+  size_t coalesced_;
+  size_t promoted_;
+};
+
+#endif
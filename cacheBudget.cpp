@@ -0,0 +1,56 @@
+/*
+ *  cacheBudget.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "cacheBudget.h"
+#include <algorithm>
+
+const char kBudgetStatisticsFormat[] = "Display caches: %zu of %zu bytes, %zu evictions\n";
+
+CacheBudget::CacheBudget(size_t bytes) : bytes_(bytes), used_(0), evicted_(0), clock_(0) {}
+
+void CacheBudget::Register(Client* client) {
+  clients_.push_back(client);
+}
+
+void CacheBudget::Unregister(Client* client) {
+  clients_.erase(std::remove(clients_.begin(), clients_.end(), client), clients_.end());
+}
+
+bool CacheBudget::Charge(size_t bytes) {
+  if (bytes > bytes_) {
+    return false;
+  }
+  while (used() + bytes > bytes_) {
+    Client* oldest = nullptr;
+    uint64_t oldest_tick = 0;
+    for (size_t i = 0; i < clients_.size(); ++i) {
+      uint64_t tick = 0;
+      if (clients_[i]->OldestUse(&tick) && (oldest == nullptr || tick < oldest_tick)) {
+        oldest = clients_[i];
+        oldest_tick = tick;
+      }
+    }
+    if (oldest == nullptr) {
+      return false;
+    }
+    oldest->EvictOldest();
+    evicted_.fetch_add(1, std::memory_order_relaxed);
+  }
+  used_.fetch_add(bytes, std::memory_order_relaxed);
+  return true;
+}
+
+void CacheBudget::Release(size_t bytes) {
+  used_.fetch_sub(std::min(bytes, used()), std::memory_order_relaxed);
+}
+
+void CacheBudget::PrintStatistics(FILE* file) const {
+  fprintf(file, kBudgetStatisticsFormat, used(), bytes_, evicted());
+}
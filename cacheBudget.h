@@ -0,0 +1,68 @@
+/*
+ *  cacheBudget.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_CACHE_BUDGET
+#define XKBGROWL_CACHE_BUDGET
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// Default number of bytes the caches of all the displays may hold together.
+const size_t kDefaultDisplayCacheBudget = 32 * 1024 * 1024;
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Byte budget shared by the caches of all the displays: cached window icons
+// and shared memory segments. When a cache needs more room than is left, the
+// least recently used memory of any cache, whichever display it belongs to,
+// is freed first. Only used by the thread that reads the displays, but
+// statistics can be read from any thread.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class CacheBudget {
+public:
+  // Memory charged to the budget that can be given back.
+  class Client {
+  public:
+    virtual ~Client() {}
+    // Last use, as returned by Tick, of the memory EvictOldest would free.
+    // Returns false if the client holds nothing that can be freed.
+    virtual bool OldestUse(uint64_t* tick) const = 0;
+    // Frees the least recently used memory, releasing it from the budget.
+    virtual void EvictOldest() = 0;
+  };
+
+  explicit CacheBudget(size_t bytes);
+  void Register(Client* client);
+  void Unregister(Client* client);
+  // Charges bytes, evicting the least recently used memory of the clients
+  // until they fit. Returns false, charging nothing, if they cannot fit.
+  bool Charge(size_t bytes);
+  void Release(size_t bytes);
+  // Increasing use counter, to order the memory of all the clients.
+  uint64_t Tick() { return ++clock_; }
+
+  size_t bytes() const { return bytes_; }
+  size_t used() const { return used_.load(std::memory_order_relaxed); }
+  size_t evicted() const { return evicted_.load(std::memory_order_relaxed); }
+  void PrintStatistics(FILE* file) const;
+private:
+  CacheBudget(const CacheBudget&);
+  CacheBudget& operator=(const CacheBudget&);
+
+  const size_t bytes_;
+  std::atomic<size_t> used_;
+  std::atomic<size_t> evicted_;  // Number of evictions to make room.
+  uint64_t clock_;
+  std::vector<Client*> clients_;  // not owned
+};
+
+#endif
@@ -0,0 +1,372 @@
+/*
+ *  dbusSink.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "dbusSink.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const char kNoBusError[] = "DBUS_SESSION_BUS_ADDRESS is not set\n";
+const char kBusConnectError[] = "Could not connect to the session bus %s: %s\n";
+const char kBusAuthError[] = "Session bus refused authentication: %s\n";
+const char kApplicationName[] = "xkbgrowl";
+const char kBusName[] = "org.freedesktop.DBus";
+const char kBusPath[] = "/org/freedesktop/DBus";
+const char kNotificationsName[] = "org.freedesktop.Notifications";
+const char kNotificationsPath[] = "/org/freedesktop/Notifications";
+const char kNotifySignature[] = "susssasa{sv}i";
+const char kUnixPathKey[] = "path=";
+const char kUnixAbstractKey[] = "abstract=";
+// Message types and flags of the wire protocol.
+const uint8_t kMethodCall = 1;
+const uint8_t kNoReplyExpected = 1;
+const uint8_t kProtocolVersion = 1;
+// Header fields.
+const uint8_t kFieldPath = 1;
+const uint8_t kFieldInterface = 2;
+const uint8_t kFieldMember = 3;
+const uint8_t kFieldDestination = 6;
+const uint8_t kFieldSignature = 8;
+// Layout of the image-data hint: 8 bit R, G, B, A samples.
+const char kImageDataSignature[] = "(iiibiiay)";
+const int32_t kImageBitsPerSample = 8;
+const int32_t kImageChannels = 4;
+// Notification urgency levels.
+const uint8_t kLowUrgency = 0;
+const uint8_t kNormalUrgency = 1;
+const int32_t kDefaultExpiration = -1;
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Marshalling, little endian. Values are aligned on their size from the start
+// of the message; the body starts on a multiple of 8, so aligning from the
+// start of the body is the same.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class DbusWriter {
+public:
+  // Position of an array being written.
+  struct Array {
+    size_t length_at;
+    size_t start;
+  };
+
+  const std::vector<unsigned char>& data() const { return data_; }
+  void Align(size_t alignment) {
+    while (data_.size() % alignment) {
+      data_.push_back(0);
+    }
+  }
+  void Byte(uint8_t value) { data_.push_back(value); }
+  void Uint32(uint32_t value) {
+    Align(4);
+    for (int shift = 0; shift < 32; shift += 8) {
+      data_.push_back((value >> shift) & 0xff);
+    }
+  }
+  void Int32(int32_t value) { Uint32(static_cast<uint32_t>(value)); }
+  void String(const std::string& value) {
+    Uint32(static_cast<uint32_t>(value.size()));
+    data_.insert(data_.end(), value.begin(), value.end());
+    data_.push_back(0);
+  }
+  void Signature(const std::string& value) {
+    Byte(static_cast<uint8_t>(value.size()));
+    data_.insert(data_.end(), value.begin(), value.end());
+    data_.push_back(0);
+  }
+  // Elements of the array are aligned on element_alignment.
+  Array BeginArray(size_t element_alignment) {
+    Uint32(0);
+    Array array;
+    array.length_at = data_.size() - 4;
+    Align(element_alignment);
+    array.start = data_.size();
+    return array;
+  }
+  void EndArray(const Array& array) {
+    const uint32_t length = static_cast<uint32_t>(data_.size() - array.start);
+    for (int i = 0; i < 4; ++i) {
+      data_[array.length_at + i] = (length >> (8 * i)) & 0xff;
+    }
+  }
+  void Append(const std::vector<unsigned char>& data) {
+    data_.insert(data_.end(), data.begin(), data.end());
+  }
+  void Append(const unsigned char* data, size_t length) {
+    data_.insert(data_.end(), data, data + length);
+  }
+private:
+  std::vector<unsigned char> data_;
+};
+
+static void HeaderField(uint8_t code, char type, const std::string& value, DbusWriter* header) {
+  header->Align(8);
+  header->Byte(code);
+  header->Signature(std::string(1, type));
+  if (type == 'g') {
+    header->Signature(value);
+  } else {
+    header->String(value);
+  }
+}
+
+static std::vector<unsigned char> MethodCall(uint32_t serial, uint8_t flags,
+                                             const char* destination, const char* path,
+                                             const char* interface, const char* member,
+                                             const char* signature, const DbusWriter& body) {
+  DbusWriter message;
+  message.Byte('l');
+  message.Byte(kMethodCall);
+  message.Byte(flags);
+  message.Byte(kProtocolVersion);
+  message.Uint32(static_cast<uint32_t>(body.data().size()));
+  message.Uint32(serial);
+  const DbusWriter::Array fields = message.BeginArray(8);
+  HeaderField(kFieldPath, 'o', path, &message);
+  HeaderField(kFieldInterface, 's', interface, &message);
+  HeaderField(kFieldMember, 's', member, &message);
+  HeaderField(kFieldDestination, 's', destination, &message);
+  if (signature[0] != '\0') {
+    HeaderField(kFieldSignature, 'g', signature, &message);
+  }
+  message.EndArray(fields);
+  message.Align(8);
+  message.Append(body.data());
+  return message.data();
+}
+
+// Notification bodies may contain markup.
+static std::string EscapeMarkup(const std::string& text) {
+  std::string escaped;
+  for (size_t i = 0; i < text.size(); ++i) {
+    switch (text[i]) {
+      case '&': escaped += "&amp;"; break;
+      case '<': escaped += "&lt;"; break;
+      case '>': escaped += "&gt;"; break;
+      default: escaped += text[i];
+    }
+  }
+  return escaped;
+}
+
+// Decodes the %XX escapes of a bus address value.
+static std::string Unescape(const std::string& value) {
+  std::string result;
+  for (size_t i = 0; i < value.size(); ++i) {
+    if (value[i] == '%' && i + 2 < value.size()) {
+      result += static_cast<char>(strtol(value.substr(i + 1, 2).c_str(), nullptr, 16));
+      i += 2;
+    } else {
+      result += value[i];
+    }
+  }
+  return result;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Connection
+// ─────────────────────────────────────────────────────────────────────────────
+
+DbusSink* DbusSink::Create() {
+  const char* const address = getenv("DBUS_SESSION_BUS_ADDRESS");
+  if (address == nullptr) {
+    fprintf(stderr, kNoBusError);
+    return nullptr;
+  }
+  DbusSink* const sink = new DbusSink(address);
+  if (!sink->Connect()) {
+    delete sink;
+    return nullptr;
+  }
+  return sink;
+}
+
+DbusSink::DbusSink(const std::string& address) : address_(address), socket_(-1), serial_(0) {}
+
+DbusSink::~DbusSink() {
+  Disconnect();
+}
+
+bool DbusSink::Connect() {
+  // Addresses look like unix:path=/run/user/1000/bus,guid=…; several can be
+  // separated by semicolons, the first usable one is taken.
+  size_t start = 0;
+  while (socket_ < 0 && start < address_.size()) {
+    size_t end = address_.find(';', start);
+    if (end == std::string::npos) {
+      end = address_.size();
+    }
+    const std::string entry = address_.substr(start, end - start);
+    start = end + 1;
+    if (entry.compare(0, 5, "unix:") != 0) {
+      continue;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    socklen_t length = 0;
+    size_t key_start = 5;
+    while (key_start < entry.size() && length == 0) {
+      size_t key_end = entry.find(',', key_start);
+      if (key_end == std::string::npos) {
+        key_end = entry.size();
+      }
+      const std::string pair = entry.substr(key_start, key_end - key_start);
+      key_start = key_end + 1;
+      const bool abstract = pair.compare(0, strlen(kUnixAbstractKey), kUnixAbstractKey) == 0;
+      if (!abstract && pair.compare(0, strlen(kUnixPathKey), kUnixPathKey) != 0) {
+        continue;
+      }
+      const std::string path =
+          Unescape(pair.substr(abstract ? strlen(kUnixAbstractKey) : strlen(kUnixPathKey)));
+      // Abstract socket names start with a null byte, Linux only.
+      const size_t offset = abstract ? 1 : 0;
+      if (path.size() + offset >= sizeof(address.sun_path)) {
+        continue;
+      }
+      memcpy(address.sun_path + offset, path.data(), path.size());
+      length = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + offset +
+                                      path.size() + (abstract ? 0 : 1));
+    }
+    if (length == 0) {
+      continue;
+    }
+    socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_ >= 0 && connect(socket_, reinterpret_cast<struct sockaddr*>(&address), length)) {
+      fprintf(stderr, kBusConnectError, entry.c_str(), strerror(errno));
+      close(socket_);
+      socket_ = -1;
+    }
+  }
+  if (socket_ < 0) {
+    return false;
+  }
+  // SASL EXTERNAL authentication: the user id, in hexadecimal ASCII.
+  const std::string uid = std::to_string(getuid());
+  std::string auth("\0AUTH EXTERNAL ", 15);
+  for (size_t i = 0; i < uid.size(); ++i) {
+    char hex[3];
+    snprintf(hex, sizeof(hex), "%02x", uid[i]);
+    auth += hex;
+  }
+  auth += "\r\n";
+  std::string reply;
+  char c = 0;
+  if (!Send(std::vector<unsigned char>(auth.begin(), auth.end()))) {
+    return false;
+  }
+  while (reply.size() < 512 && recv(socket_, &c, 1, 0) == 1 && c != '\n') {
+    reply += c;
+  }
+  if (reply.compare(0, 3, "OK ") != 0) {
+    fprintf(stderr, kBusAuthError, reply.c_str());
+    Disconnect();
+    return false;
+  }
+  const std::string begin = "BEGIN\r\n";
+  // Hello must be the first message, the reply holds our unique name.
+  return Send(std::vector<unsigned char>(begin.begin(), begin.end())) &&
+      Send(MethodCall(++serial_, 0, kBusName, kBusPath, kBusName, "Hello", "", DbusWriter()));
+}
+
+void DbusSink::Disconnect() {
+  if (socket_ >= 0) {
+    close(socket_);
+    socket_ = -1;
+  }
+}
+
+bool DbusSink::Send(const std::vector<unsigned char>& message) {
+  size_t sent = 0;
+  while (socket_ >= 0 && sent < message.size()) {
+    const ssize_t written = send(socket_, message.data() + sent, message.size() - sent, 0);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      Disconnect();
+      return false;
+    }
+    sent += written;
+  }
+  return socket_ >= 0;
+}
+
+void DbusSink::DrainReplies() {
+  char buffer[4096];
+  while (socket_ >= 0) {
+    const ssize_t length = recv(socket_, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (length > 0) {
+      continue;
+    }
+    if (length == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+      Disconnect();
+    }
+    return;
+  }
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// org.freedesktop.Notifications.Notify
+// ─────────────────────────────────────────────────────────────────────────────
+
+// image-data hint: width, height, row stride, alpha, bits per sample,
+// channels and the pixels.
+static void ImageDataEntry(int width, int height, const unsigned char* rgba,
+                           DbusWriter* body) {
+  body->Align(8);
+  body->String("image-data");
+  body->Signature(kImageDataSignature);
+  body->Align(8);  // Structures are aligned on 8.
+  body->Int32(width);
+  body->Int32(height);
+  body->Int32(width * kImageChannels);
+  body->Uint32(1);  // Booleans are 32 bit.
+  body->Int32(kImageBitsPerSample);
+  body->Int32(kImageChannels);
+  const DbusWriter::Array pixels = body->BeginArray(1);
+  body->Append(rgba, size_t(width) * height * kImageChannels);
+  body->EndArray(pixels);
+}
+
+bool DbusSink::Post(const BellEvent& event, size_t count, const IconBlob* icon) {
+  DrainReplies();
+  if (socket_ < 0 && !Connect()) {
+    return false;
+  }
+  DbusWriter body;
+  body.String(kApplicationName);
+  body.Uint32(0);  // replaces_id
+  body.String("");  // app_icon, the window icon goes in the hints.
+  // The bus drops connections that send strings that are not UTF-8.
+  body.String(ToUtf8(event.name()));
+  body.String(EscapeMarkup(ToUtf8(NotificationText(event, count))));
+  body.EndArray(body.BeginArray(4));  // No actions.
+  const DbusWriter::Array hints = body.BeginArray(8);
+  body.Align(8);
+  body.String("urgency");
+  body.Signature("y");
+  body.Byte(event.percent() < 50 ? kLowUrgency : kNormalUrgency);
+  int width = 0;
+  int height = 0;
+  const unsigned char* rgba = nullptr;
+  if (icon != nullptr && DecodeRgbaIcon(*icon, &width, &height, &rgba)) {
+    ImageDataEntry(width, height, rgba, &body);
+  }
+  body.EndArray(hints);
+  body.Int32(kDefaultExpiration);
+  return Send(MethodCall(++serial_, kNoReplyExpected, kNotificationsName, kNotificationsPath,
+                         kNotificationsName, "Notify", kNotifySignature, body));
+}
@@ -0,0 +1,49 @@
+/*
+ *  dbusSink.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_DBUS_SINK
+#define XKBGROWL_DBUS_SINK
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "notificationSink.h"
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Sends freedesktop.org desktop notifications over the D-Bus session bus.
+// Only the few messages needed are implemented, directly on top of the bus
+// socket, so there is no dependency on libdbus. Icons are sent inline, as
+// the pixels of the image-data hint, so no file is ever written.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class DbusSink : public NotificationSink {
+public:
+  // Connects to the bus in DBUS_SESSION_BUS_ADDRESS, null if that fails.
+  static DbusSink* Create();
+  ~DbusSink();
+  const char* name() const { return "dbus"; }
+  IconEncoding iconEncoding() const { return kRgbaEncoding; }
+  bool Post(const BellEvent& event, size_t count, const IconBlob* icon);
+private:
+  explicit DbusSink(const std::string& address);
+  // Opens the connection and authenticates, returns false on failure.
+  bool Connect();
+  void Disconnect();
+  bool Send(const std::vector<unsigned char>& message);
+  // Reads and drops whatever the bus sent: replies, signals.
+  void DrainReplies();
+
+  const std::string address_;
+  int socket_;     // -1 when not connected.
+  uint32_t serial_;
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ *  displayMultiplexer.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "displayMultiplexer.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+// Number of readiness notifications read by one epoll_wait call.
+const int kMaxReadyEvents = 64;
+const char kDisplayRemovedFormat[] = "Stopped watching a lost display, %zu left.\n";
+
+DisplayMultiplexer::DisplayMultiplexer(size_t cache_budget)
+: budget_(cache_budget), epoll_fd_(-1) {
+#ifdef __linux__
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    perror("epoll_create1");
+    exit(EX_OSERR);
+  }
+#endif
+}
+
+DisplayMultiplexer::~DisplayMultiplexer() {
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+}
+
+void DisplayMultiplexer::Add(X11DisplayData* display) {
+  const size_t index = displays_.size();
+  displays_.push_back(std::unique_ptr<X11DisplayData>(display));
+  is_ready_.push_back(false);
+  display->SetCacheBudget(&budget_);
+#ifdef __linux__
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = index;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, display->FileDescriptor(), &event) < 0) {
+    perror("epoll_ctl");
+    exit(EX_OSERR);
+  }
+#endif
+  // Events may have been read while the connection was set up.
+  MarkReady(index);
+}
+
+void DisplayMultiplexer::MarkReady(size_t index) {
+  if (!is_ready_[index]) {
+    is_ready_[index] = true;
+    ready_.push_back(index);
+  }
+}
+
+void DisplayMultiplexer::Remove(size_t index) {
+#ifdef __linux__
+  // The descriptor is still open, it is closed with the display.
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, displays_[index]->FileDescriptor(), nullptr);
+#endif
+  displays_.erase(displays_.begin() + index);
+  is_ready_.erase(is_ready_.begin() + index);
+  // Displays after index move down by one.
+  std::vector<size_t> ready;
+  for (size_t i = 0; i < ready_.size(); ++i) {
+    if (ready_[i] != index) {
+      ready.push_back(ready_[i] > index ? ready_[i] - 1 : ready_[i]);
+    }
+  }
+  ready_.swap(ready);
+#ifdef __linux__
+  for (size_t i = index; i < displays_.size(); ++i) {
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = i;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, displays_[i]->FileDescriptor(), &event) < 0) {
+      perror("epoll_ctl");
+    }
+  }
+#endif
+  fprintf(stderr, kDisplayRemovedFormat, displays_.size());
+}
+
+void DisplayMultiplexer::WaitForReadyDisplays(int timeout) {
+#ifdef __linux__
+  struct epoll_event events[kMaxReadyEvents];
+  const int count = epoll_wait(epoll_fd_, events, kMaxReadyEvents, timeout);
+  if (count < 0 && errno != EINTR) {
+    perror("epoll_wait");
+  }
+  for (int i = 0; i < count; ++i) {
+    MarkReady(events[i].data.u64);
+  }
+#else
+  std::vector<struct pollfd> descriptors(displays_.size());
+  for (size_t i = 0; i < displays_.size(); ++i) {
+    descriptors[i].fd = displays_[i]->FileDescriptor();
+    descriptors[i].events = POLLIN;
+    descriptors[i].revents = 0;
+  }
+  const int count = poll(descriptors.data(), descriptors.size(), timeout);
+  if (count < 0 && errno != EINTR) {
+    perror("poll");
+  }
+  for (size_t i = 0; count > 0 && i < descriptors.size(); ++i) {
+    if (descriptors[i].revents) {
+      MarkReady(i);
+    }
+  }
+#endif
+}
+
+void DisplayMultiplexer::SetRateLimiter(BellRateLimiter* limiter) {
+  for (size_t i = 0; i < displays_.size(); ++i) {
+    displays_[i]->SetRateLimiter(limiter);
+  }
+}
+
+size_t DisplayMultiplexer::NextBellEvents(size_t max, int timeout,
+                                          std::vector<std::unique_ptr<BellEvent> >* events) {
+  // Displays already known to be ready are drained without waiting, but
+  // still give the others a chance to be picked up.
+  WaitForReadyDisplays(ready_.empty() ? timeout : 0);
+  const size_t start = events->size();
+  std::vector<size_t> draining;
+  draining.swap(ready_);
+  std::vector<size_t> lost;
+  for (size_t i = 0; i < draining.size(); ++i) {
+    const size_t index = draining[i];
+    is_ready_[index] = false;
+    const size_t added = events->size() - start;
+    if (added < max) {
+      displays_[index]->NextBellEvents(max - added, events);
+    }
+    // Fetching attributes can read events that the descriptor will not signal.
+    if (displays_[index]->HasQueuedEvents()) {
+      MarkReady(index);
+    } else if (!displays_[index]->connected()) {
+      lost.push_back(index);
+    }
+  }
+  // From the last, so that the other indexes stay valid.
+  std::sort(lost.begin(), lost.end());
+  for (size_t i = lost.size(); i > 0; --i) {
+    Remove(lost[i - 1]);
+  }
+  return events->size() - start;
+}
+
+void DisplayMultiplexer::PrintStatistics(FILE* file) const {
+  budget_.PrintStatistics(file);
+}
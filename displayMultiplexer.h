@@ -0,0 +1,57 @@
+/*
+ *  displayMultiplexer.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_DISPLAY_MULTIPLEXER
+#define XKBGROWL_DISPLAY_MULTIPLEXER
+#include <memory>
+#include <stdio.h>
+#include <vector>
+#include "cacheBudget.h"
+#include "x11Util.h"
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Watches any number of displays from a single thread. Connections are
+// multiplexed with epoll on Linux and poll elsewhere; only displays that have
+// something to read are drained, so idle displays cost no system call.
+// A display whose connection is lost is dropped, the others go on. The caches
+// of all the displays share a single byte budget.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class DisplayMultiplexer {
+public:
+  // The caches of the displays hold at most cache_budget bytes.
+  explicit DisplayMultiplexer(size_t cache_budget);
+  ~DisplayMultiplexer();
+  // Adds a display to watch, takes ownership.
+  void Add(X11DisplayData* display);
+  size_t size() const { return displays_.size(); }
+  // Sets the rate limiter of all the displays added so far.
+  void SetRateLimiter(BellRateLimiter* limiter);
+  // Waits at most timeout ms for events on any display, then appends at most
+  // max events to events. Returns the number of events added.
+  size_t NextBellEvents(size_t max, int timeout, std::vector<std::unique_ptr<BellEvent> >* events);
+  void PrintStatistics(FILE* file) const;
+private:
+  DisplayMultiplexer(const DisplayMultiplexer&);
+  DisplayMultiplexer& operator=(const DisplayMultiplexer&);
+  // Adds the displays whose connection is readable to ready_.
+  void WaitForReadyDisplays(int timeout);
+  void MarkReady(size_t index);
+  // Drops the display at index, whose connection is lost.
+  void Remove(size_t index);
+
+  CacheBudget budget_;  // Declared first, it outlives the displays.
+  std::vector<std::unique_ptr<X11DisplayData> > displays_;
+  std::vector<size_t> ready_;       // Displays to drain, by index.
+  std::vector<bool> is_ready_;      // Membership in ready_, by index.
+  int epoll_fd_;                    // -1 when poll is used.
+};
+
+#endif
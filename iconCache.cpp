@@ -0,0 +1,94 @@
+/*
+ *  iconCache.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "iconCache.h"
+#include <string.h>
+
+// ─────────────────────────────────────────────────────────────────────────────
+// MurmurHash64A, by Austin Appleby, placed in the public domain.
+// ─────────────────────────────────────────────────────────────────────────────
+
+uint64_t HashPixels(const void* data, size_t length, uint64_t seed) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (length * m);
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  const unsigned char* const end = p + (length & ~size_t(7));
+  for (; p != end; p += 8) {
+    uint64_t k;
+    memcpy(&k, p, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  switch (length & 7) {
+    case 7: h ^= uint64_t(p[6]) << 48;  // fall through
+    case 6: h ^= uint64_t(p[5]) << 40;  // fall through
+    case 5: h ^= uint64_t(p[4]) << 32;  // fall through
+    case 4: h ^= uint64_t(p[3]) << 24;  // fall through
+    case 3: h ^= uint64_t(p[2]) << 16;  // fall through
+    case 2: h ^= uint64_t(p[1]) << 8;   // fall through
+    case 1: h ^= uint64_t(p[0]);
+      h *= m;
+  }
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Icon cache
+// ─────────────────────────────────────────────────────────────────────────────
+
+IconCache::IconCache(size_t byte_budget)
+: byte_budget_(byte_budget), bytes_(0), hits_(0), misses_(0) {}
+
+std::shared_ptr<const IconBlob> IconCache::Lookup(const IconKey& key) {
+  std::unordered_map<IconKey, EntryList::iterator, IconKeyHash>::iterator it = index_.find(key);
+  if (it == index_.end()) {
+    ++misses_;
+    return std::shared_ptr<const IconBlob>();
+  }
+  ++hits_;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->second;
+}
+
+void IconCache::Insert(const IconKey& key, const std::shared_ptr<const IconBlob>& blob) {
+  if (blob == nullptr || blob->size() > byte_budget_) {
+    return;
+  }
+  std::unordered_map<IconKey, EntryList::iterator, IconKeyHash>::iterator it = index_.find(key);
+  if (it != index_.end()) {
+    bytes_ -= it->second->second->size();
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+  entries_.push_front(std::make_pair(key, blob));
+  index_[key] = entries_.begin();
+  bytes_ += blob->size();
+  Evict();
+}
+
+void IconCache::Evict() {
+  while (bytes_ > byte_budget_ && !entries_.empty()) {
+    bytes_ -= entries_.back().second->size();
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+void IconCache::PrintStatistics(FILE* file) const {
+  fprintf(file, "Icon cache: %zu hits, %zu misses, %zu icons, %zu bytes\n",
+          hits_, misses_, entries_.size(), bytes_);
+}
@@ -0,0 +1,75 @@
+/*
+ *  iconCache.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_ICON_CACHE
+#define XKBGROWL_ICON_CACHE
+#include <list>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+
+// Encoded notification icon, ready to be sent.
+typedef std::vector<unsigned char> IconBlob;
+
+// Fast, non cryptographic, 64 bit hash of a block of memory (MurmurHash64A).
+uint64_t HashPixels(const void* data, size_t length, uint64_t seed = 0);
+
+// Identifies an encoded icon: the content of the source pixels, the size
+// they were converted to and the image format they were encoded in.
+struct IconKey {
+  uint64_t hash;     // HashPixels of the source ARGB pixels.
+  int width;         // Source dimensions.
+  int height;
+  int target_size;   // Size of the encoded icon.
+  int encoding;      // IconEncoding of the blob.
+
+  bool operator==(const IconKey& other) const {
+    return hash == other.hash && width == other.width && height == other.height &&
+        target_size == other.target_size && encoding == other.encoding;
+  }
+};
+
+struct IconKeyHash {
+  size_t operator()(const IconKey& key) const { return static_cast<size_t>(key.hash); }
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Content addressed cache of encoded icons, least recently used blobs are
+// evicted once the total size exceeds the byte budget.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class IconCache {
+public:
+  explicit IconCache(size_t byte_budget);
+  // Returns the cached blob or null, counts a hit or a miss.
+  std::shared_ptr<const IconBlob> Lookup(const IconKey& key);
+  void Insert(const IconKey& key, const std::shared_ptr<const IconBlob>& blob);
+
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+  size_t bytes() const { return bytes_; }
+  size_t size() const { return entries_.size(); }
+  void PrintStatistics(FILE* file) const;
+private:
+  typedef std::list<std::pair<IconKey, std::shared_ptr<const IconBlob> > > EntryList;
+  void Evict();
+
+  const size_t byte_budget_;
+  size_t bytes_;
+  size_t hits_;
+  size_t misses_;
+  EntryList entries_;  // Most recently used first.
+  std::unordered_map<IconKey, EntryList::iterator, IconKeyHash> index_;
+};
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ *  iconEncoder.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "iconEncoder.h"
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+const char kCompressionError[] = "Could not compress %dx%d icon: %d\n";
+
+const char* IconEncodingName(IconEncoding encoding) {
+  switch (encoding) {
+    case kPngEncoding: return "png";
+    case kQoiEncoding: return "qoi";
+    case kRgbaEncoding: return "rgba";
+  }
+  return "";
+}
+
+static void AppendBigEndian32(uint32_t value, IconBlob* blob) {
+  blob->push_back(value >> 24);
+  blob->push_back(value >> 16);
+  blob->push_back(value >> 8);
+  blob->push_back(value);
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// PNG: 8 bit RGBA, every row with the Sub filter, deflated at the fastest
+// level. Icons are small, speed matters more than the last percent of size.
+// ─────────────────────────────────────────────────────────────────────────────
+
+const unsigned char kPngSignature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+const unsigned char kPngColourTypeRGBA = 6;
+const unsigned char kPngSubFilter = 1;
+
+static void AppendPngChunk(const char* type, const unsigned char* data, size_t length,
+                           IconBlob* blob) {
+  AppendBigEndian32(static_cast<uint32_t>(length), blob);
+  const size_t start = blob->size();
+  blob->insert(blob->end(), type, type + 4);
+  blob->insert(blob->end(), data, data + length);
+  // The CRC covers the type and the data.
+  const uLong crc = crc32(0, &(*blob)[start], static_cast<uInt>(length + 4));
+  AppendBigEndian32(static_cast<uint32_t>(crc), blob);
+}
+
+static bool EncodePng(const unsigned char* argb, int width, int height, IconBlob* blob) {
+  // Filtered scanlines: a filter byte, then the difference of each byte with
+  // the same channel of the pixel on its left.
+  const size_t row_bytes = size_t(width) * 4;
+  std::vector<unsigned char> raw((row_bytes + 1) * height);
+  unsigned char* out = raw.data();
+  for (int y = 0; y < height; ++y) {
+    const unsigned char* const row = argb + y * row_bytes;
+    *out++ = kPngSubFilter;
+    unsigned char left[4] = { 0, 0, 0, 0 };
+    for (int x = 0; x < width; ++x) {
+      const unsigned char* const p = row + x * 4;
+      const unsigned char rgba[4] = { p[1], p[2], p[3], p[0] };
+      for (int c = 0; c < 4; ++c) {
+        *out++ = rgba[c] - left[c];
+        left[c] = rgba[c];
+      }
+    }
+  }
+  uLongf compressed_length = compressBound(raw.size());
+  std::vector<unsigned char> compressed(compressed_length);
+  const int status = compress2(compressed.data(), &compressed_length, raw.data(), raw.size(),
+                               Z_BEST_SPEED);
+  if (status != Z_OK) {
+    fprintf(stderr, kCompressionError, width, height, status);
+    return false;
+  }
+  blob->clear();
+  blob->reserve(compressed_length + 64);
+  blob->insert(blob->end(), kPngSignature, kPngSignature + sizeof(kPngSignature));
+  IconBlob header;
+  AppendBigEndian32(width, &header);
+  AppendBigEndian32(height, &header);
+  // Bit depth, colour type, compression, filter and interlace methods.
+  const unsigned char format[] = { 8, kPngColourTypeRGBA, 0, 0, 0 };
+  header.insert(header.end(), format, format + sizeof(format));
+  AppendPngChunk("IHDR", header.data(), header.size(), blob);
+  AppendPngChunk("IDAT", compressed.data(), compressed_length, blob);
+  AppendPngChunk("IEND", nullptr, 0, blob);
+  return true;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// QOI, as specified on https://qoiformat.org
+// ─────────────────────────────────────────────────────────────────────────────
+
+const unsigned char kQoiOpIndex = 0x00;
+const unsigned char kQoiOpDiff = 0x40;
+const unsigned char kQoiOpLuma = 0x80;
+const unsigned char kQoiOpRun = 0xc0;
+const unsigned char kQoiOpRGB = 0xfe;
+const unsigned char kQoiOpRGBA = 0xff;
+const int kQoiMaxRun = 62;
+const unsigned char kQoiEnd[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+struct QoiPixel {
+  unsigned char r, g, b, a;
+  bool operator==(const QoiPixel& other) const {
+    return r == other.r && g == other.g && b == other.b && a == other.a;
+  }
+  int Hash() const { return (r * 3 + g * 5 + b * 7 + a * 11) % 64; }
+};
+
+static bool EncodeQoi(const unsigned char* argb, int width, int height, IconBlob* blob) {
+  blob->clear();
+  blob->reserve(size_t(width) * height * 5 + 22);
+  blob->push_back('q');
+  blob->push_back('o');
+  blob->push_back('i');
+  blob->push_back('f');
+  AppendBigEndian32(width, blob);
+  AppendBigEndian32(height, blob);
+  blob->push_back(4);  // RGBA
+  blob->push_back(0);  // sRGB with linear alpha
+  QoiPixel index[64];
+  memset(index, 0, sizeof(index));
+  QoiPixel previous = { 0, 0, 0, 255 };
+  int run = 0;
+  const size_t count = size_t(width) * height;
+  for (size_t i = 0; i < count; ++i) {
+    const unsigned char* const p = argb + i * 4;
+    const QoiPixel pixel = { p[1], p[2], p[3], p[0] };
+    if (pixel == previous) {
+      ++run;
+      if (run == kQoiMaxRun || i + 1 == count) {
+        blob->push_back(kQoiOpRun | (run - 1));
+        run = 0;
+      }
+      continue;
+    }
+    if (run > 0) {
+      blob->push_back(kQoiOpRun | (run - 1));
+      run = 0;
+    }
+    const int hash = pixel.Hash();
+    if (index[hash] == pixel) {
+      blob->push_back(kQoiOpIndex | hash);
+    } else {
+      index[hash] = pixel;
+      if (pixel.a == previous.a) {
+        const signed char dr = pixel.r - previous.r;
+        const signed char dg = pixel.g - previous.g;
+        const signed char db = pixel.b - previous.b;
+        const signed char dr_dg = dr - dg;
+        const signed char db_dg = db - dg;
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+          blob->push_back(kQoiOpDiff | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+        } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                   db_dg >= -8 && db_dg <= 7) {
+          blob->push_back(kQoiOpLuma | (dg + 32));
+          blob->push_back(((dr_dg + 8) << 4) | (db_dg + 8));
+        } else {
+          blob->push_back(kQoiOpRGB);
+          blob->push_back(pixel.r);
+          blob->push_back(pixel.g);
+          blob->push_back(pixel.b);
+        }
+      } else {
+        blob->push_back(kQoiOpRGBA);
+        blob->push_back(pixel.r);
+        blob->push_back(pixel.g);
+        blob->push_back(pixel.b);
+        blob->push_back(pixel.a);
+      }
+    }
+    previous = pixel;
+  }
+  blob->insert(blob->end(), kQoiEnd, kQoiEnd + sizeof(kQoiEnd));
+  return true;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Raw RGBA: width and height, big endian, then the pixels as they are.
+// ─────────────────────────────────────────────────────────────────────────────
+
+const size_t kRgbaHeaderSize = 8;
+
+static uint32_t ReadBigEndian32(const unsigned char* data) {
+  return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) |
+      data[3];
+}
+
+static bool EncodeRgba(const unsigned char* argb, int width, int height, IconBlob* blob) {
+  const size_t count = size_t(width) * height;
+  blob->clear();
+  blob->reserve(kRgbaHeaderSize + count * 4);
+  AppendBigEndian32(width, blob);
+  AppendBigEndian32(height, blob);
+  for (size_t i = 0; i < count; ++i) {
+    const unsigned char* const p = argb + i * 4;
+    blob->push_back(p[1]);
+    blob->push_back(p[2]);
+    blob->push_back(p[3]);
+    blob->push_back(p[0]);
+  }
+  return true;
+}
+
+bool DecodeRgbaIcon(const IconBlob& blob, int* width, int* height,
+                    const unsigned char** rgba) {
+  if (blob.size() < kRgbaHeaderSize) {
+    return false;
+  }
+  const uint32_t blob_width = ReadBigEndian32(blob.data());
+  const uint32_t blob_height = ReadBigEndian32(blob.data() + 4);
+  if (blob.size() != kRgbaHeaderSize + uint64_t(blob_width) * blob_height * 4) {
+    return false;
+  }
+  *width = static_cast<int>(blob_width);
+  *height = static_cast<int>(blob_height);
+  *rgba = blob.data() + kRgbaHeaderSize;
+  return true;
+}
+
+bool EncodeIcon(const unsigned char* argb, int width, int height, IconEncoding encoding,
+                IconBlob* blob) {
+  switch (encoding) {
+    case kPngEncoding:
+      return EncodePng(argb, width, height, blob);
+    case kQoiEncoding:
+      return EncodeQoi(argb, width, height, blob);
+    case kRgbaEncoding:
+      return EncodeRgba(argb, width, height, blob);
+  }
+  return false;
+}
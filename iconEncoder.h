@@ -0,0 +1,37 @@
+/*
+ *  iconEncoder.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_ICON_ENCODER
+#define XKBGROWL_ICON_ENCODER
+
+#include "iconCache.h"
+
+// Image formats notification icons can be sent in.
+enum IconEncoding {
+  kPngEncoding,  // Understood by every image library, zlib at its fastest level.
+  kQoiEncoding,  // Quite OK Image format: faster to encode, slightly larger.
+  kRgbaEncoding  // Uncompressed, for sinks that pass pixels, see DecodeRgbaIcon.
+};
+const int kNumIconEncodings = kRgbaEncoding + 1;
+
+// Name of the encoding, as used on the command line.
+const char* IconEncodingName(IconEncoding encoding);
+
+// Encodes width × height pixels, given as A, R, G, B bytes, not premultiplied.
+// Returns false if the pixels could not be compressed.
+bool EncodeIcon(const unsigned char* argb, int width, int height, IconEncoding encoding,
+                IconBlob* blob);
+
+// Dimensions and R, G, B, A bytes, rows packed, of a kRgbaEncoding blob.
+// Returns false if blob is not one.
+bool DecodeRgbaIcon(const IconBlob& blob, int* width, int* height,
+                    const unsigned char** rgba);
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ *  iconResampler.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "iconResampler.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "pixelKernels.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Weights for that many size pairs are kept, icons come in a handful of sizes.
+const size_t kMaxCachedWeights = 32;
+const double kLanczosLobes = 3.0;
+const int kChannels = 4;
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Four float channels of one pixel, in a vector register where available.
+// ─────────────────────────────────────────────────────────────────────────────
+
+#if defined(__SSE2__)
+typedef __m128 Pixel4;
+static inline Pixel4 LoadPixel(const float* p) { return _mm_loadu_ps(p); }
+static inline void StorePixel(float* p, Pixel4 v) { _mm_storeu_ps(p, v); }
+static inline Pixel4 ZeroPixel() { return _mm_setzero_ps(); }
+static inline Pixel4 MultiplyAdd(Pixel4 sum, Pixel4 v, float weight) {
+  return _mm_add_ps(sum, _mm_mul_ps(v, _mm_set1_ps(weight)));
+}
+#elif defined(__ARM_NEON)
+typedef float32x4_t Pixel4;
+static inline Pixel4 LoadPixel(const float* p) { return vld1q_f32(p); }
+static inline void StorePixel(float* p, Pixel4 v) { vst1q_f32(p, v); }
+static inline Pixel4 ZeroPixel() { return vdupq_n_f32(0.0f); }
+static inline Pixel4 MultiplyAdd(Pixel4 sum, Pixel4 v, float weight) {
+  return vmlaq_n_f32(sum, v, weight);
+}
+#else
+struct Pixel4 {
+  float v[kChannels];
+};
+static inline Pixel4 LoadPixel(const float* p) {
+  Pixel4 result = { { p[0], p[1], p[2], p[3] } };
+  return result;
+}
+static inline void StorePixel(float* p, Pixel4 v) { memcpy(p, v.v, sizeof(v.v)); }
+static inline Pixel4 ZeroPixel() {
+  Pixel4 result = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+  return result;
+}
+static inline Pixel4 MultiplyAdd(Pixel4 sum, Pixel4 v, float weight) {
+  for (int c = 0; c < kChannels; ++c) {
+    sum.v[c] += v.v[c] * weight;
+  }
+  return sum;
+}
+#endif
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Filters
+// ─────────────────────────────────────────────────────────────────────────────
+
+static double Lanczos(double x) {
+  x = fabs(x);
+  if (x < 1e-9) {
+    return 1.0;
+  }
+  if (x >= kLanczosLobes) {
+    return 0.0;
+  }
+  const double pi_x = M_PI * x;
+  return kLanczosLobes * sin(pi_x) * sin(pi_x / kLanczosLobes) / (pi_x * pi_x);
+}
+
+static double Box(double x) {
+  return x >= -0.5 && x < 0.5 ? 1.0 : 0.0;
+}
+
+void FitIconSize(int width, int height, int size, int* fit_width, int* fit_height) {
+  if (width >= height) {
+    *fit_width = size;
+    *fit_height = std::max(1, static_cast<int>(lround(double(height) * size / width)));
+  } else {
+    *fit_height = size;
+    *fit_width = std::max(1, static_cast<int>(lround(double(width) * size / height)));
+  }
+}
+
+IconResampler::IconResampler(ResampleFilter filter)
+: filter_(filter), source_width_(0), width_(0), height_(0), argb_(nullptr),
+  horizontal_(nullptr), vertical_(nullptr), next_source_row_(0), next_target_row_(0) {}
+
+void IconResampler::ComputeWeights(int source, int target, Weights* weights) const {
+  // Source pixels per target pixel; when shrinking the filter is stretched
+  // so that every source pixel contributes.
+  const double scale = double(source) / target;
+  const double stretch = std::max(1.0, scale);
+  const double radius = (filter_ == kLanczosFilter ? kLanczosLobes : 0.5) * stretch;
+  std::vector<std::vector<float> > all(target);
+  std::vector<int> first(target);
+  int taps = 1;
+  for (int x = 0; x < target; ++x) {
+    const double center = (x + 0.5) * scale;
+    const int left = std::max(0, static_cast<int>(floor(center - radius)));
+    const int right = std::min(source, static_cast<int>(ceil(center + radius)));
+    std::vector<float>& coefficients = all[x];
+    double total = 0.0;
+    for (int i = left; i < right; ++i) {
+      const double distance = (i + 0.5 - center) / stretch;
+      const double weight = filter_ == kLanczosFilter ? Lanczos(distance) : Box(distance);
+      coefficients.push_back(static_cast<float>(weight));
+      total += weight;
+    }
+    if (total == 0.0) {
+      // Can only happen at the edges with the box filter: nearest pixel.
+      coefficients.assign(1, 1.0f);
+      first[x] = std::min(source - 1, static_cast<int>(center));
+    } else {
+      for (size_t i = 0; i < coefficients.size(); ++i) {
+        coefficients[i] = static_cast<float>(coefficients[i] / total);
+      }
+      first[x] = left;
+    }
+    taps = std::max(taps, static_cast<int>(coefficients.size()));
+  }
+  // Every target pixel gets the same number of taps, padded with zeros and
+  // kept within the source.
+  weights->taps = taps;
+  weights->first.resize(target);
+  weights->coefficients.assign(size_t(target) * taps, 0.0f);
+  for (int x = 0; x < target; ++x) {
+    const int start = std::max(0, std::min(first[x], source - taps));
+    weights->first[x] = start;
+    float* const destination = &weights->coefficients[size_t(x) * taps];
+    for (size_t i = 0; i < all[x].size(); ++i) {
+      destination[first[x] - start + i] = all[x][i];
+    }
+  }
+}
+
+const IconResampler::Weights& IconResampler::WeightsFor(int source, int target) {
+  const std::pair<int, int> key(source, target);
+  std::map<std::pair<int, int>, Weights>::const_iterator it = weights_.find(key);
+  if (it != weights_.end()) {
+    return it->second;
+  }
+  if (weights_.size() >= kMaxCachedWeights) {
+    weights_.clear();
+  }
+  Weights& weights = weights_[key];
+  ComputeWeights(source, target, &weights);
+  return weights;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Scaling
+// ─────────────────────────────────────────────────────────────────────────────
+
+// A, R, G, B bytes to premultiplied floats.
+static void Premultiply(const unsigned char* argb, int count, float* pixels) {
+  for (int i = 0; i < count; ++i, argb += 4, pixels += kChannels) {
+    const float alpha = argb[0];
+    const float factor = alpha / 255.0f;
+    pixels[0] = alpha;
+    pixels[1] = argb[1] * factor;
+    pixels[2] = argb[2] * factor;
+    pixels[3] = argb[3] * factor;
+  }
+}
+
+static inline unsigned char Clamp(float value) {
+  return value <= 0.0f ? 0 : value >= 255.0f ? 255 : static_cast<unsigned char>(value + 0.5f);
+}
+
+// Premultiplied floats back to A, R, G, B bytes.
+static void Unpremultiply(const float* pixels, int count, unsigned char* argb) {
+  for (int i = 0; i < count; ++i, argb += 4, pixels += kChannels) {
+    const unsigned char alpha = Clamp(pixels[0]);
+    argb[0] = alpha;
+    if (alpha == 0) {
+      argb[1] = argb[2] = argb[3] = 0;
+      continue;
+    }
+    const float factor = 255.0f / alpha;
+    argb[1] = Clamp(pixels[1] * factor);
+    argb[2] = Clamp(pixels[2] * factor);
+    argb[3] = Clamp(pixels[3] * factor);
+  }
+}
+
+void IconResampler::Start(int source_width, int source_height, int width, int height,
+                          unsigned char* argb) {
+  assert(source_width > 0 && source_height > 0 && width > 0 && height > 0);
+  source_width_ = source_width;
+  width_ = width;
+  height_ = height;
+  argb_ = argb;
+  next_source_row_ = 0;
+  next_target_row_ = 0;
+  argb_row_.resize(size_t(source_width) * 4);
+  if (source_width == width && source_height == height) {
+    // Nothing to scale, only the layout may need converting.
+    horizontal_ = nullptr;
+    vertical_ = nullptr;
+    return;
+  }
+  // Both references stay valid: at most two entries are added per scaling.
+  if (weights_.size() + 2 > kMaxCachedWeights) {
+    weights_.clear();
+  }
+  horizontal_ = &WeightsFor(source_width, width);
+  vertical_ = &WeightsFor(source_height, height);
+  row_.resize(size_t(source_width) * kChannels);
+  ring_.resize(size_t(vertical_->taps) * width * kChannels);
+  output_row_.resize(size_t(width) * kChannels);
+}
+
+void IconResampler::AddRow(const unsigned char* row, PixelFormat format) {
+  const int y = next_source_row_++;
+  if (horizontal_ == nullptr) {
+    ConvertToARGB(row, format, width_, argb_ + size_t(y) * width_ * 4);
+    return;
+  }
+  const unsigned char* argb_row = row;
+  if (format != kPixelFormatARGB) {
+    ConvertToARGB(row, format, source_width_, argb_row_.data());
+    argb_row = argb_row_.data();
+  }
+  Premultiply(argb_row, source_width_, row_.data());
+  // Horizontal pass, into the slot of the ring that held row y - taps.
+  const Weights& horizontal = *horizontal_;
+  float* const scaled = &ring_[size_t(y % vertical_->taps) * width_ * kChannels];
+  for (int x = 0; x < width_; ++x) {
+    const float* const coefficients = &horizontal.coefficients[size_t(x) * horizontal.taps];
+    const float* pixel = &row_[size_t(horizontal.first[x]) * kChannels];
+    Pixel4 sum = ZeroPixel();
+    for (int k = 0; k < horizontal.taps; ++k, pixel += kChannels) {
+      sum = MultiplyAdd(sum, LoadPixel(pixel), coefficients[k]);
+    }
+    StorePixel(scaled + x * kChannels, sum);
+  }
+  // Target rows whose last source row just arrived. The first source row
+  // never decreases, so the rows a target row needs are all in the ring.
+  while (next_target_row_ < height_ &&
+         vertical_->first[next_target_row_] + vertical_->taps - 1 <= y) {
+    WriteRow(next_target_row_++);
+  }
+}
+
+void IconResampler::WriteRow(int y) {
+  const Weights& vertical = *vertical_;
+  const float* const coefficients = &vertical.coefficients[size_t(y) * vertical.taps];
+  const size_t row_floats = size_t(width_) * kChannels;
+  std::fill(output_row_.begin(), output_row_.end(), 0.0f);
+  for (int k = 0; k < vertical.taps; ++k) {
+    const float weight = coefficients[k];
+    if (weight == 0.0f) {
+      continue;
+    }
+    const float* const input = &ring_[((vertical.first[y] + k) % vertical.taps) * row_floats];
+    for (size_t i = 0; i < row_floats; i += kChannels) {
+      StorePixel(&output_row_[i], MultiplyAdd(LoadPixel(&output_row_[i]),
+                                              LoadPixel(input + i), weight));
+    }
+  }
+  Unpremultiply(output_row_.data(), width_, argb_ + size_t(y) * width_ * 4);
+}
+
+void IconResampler::Resample(const PixelView& source, int source_width, int source_height,
+                             int width, int height, unsigned char* argb) {
+  Start(source_width, source_height, width, height, argb);
+  for (int y = 0; y < source_height; ++y) {
+    AddRow(source.data + y * source.stride, source.format);
+  }
+  assert(next_target_row_ == height || horizontal_ == nullptr);
+}
+
+void IconResampler::Resample(const ImageProxy& source, int width, int height,
+                             unsigned char* argb) {
+  PixelView view;
+  if (source.pixelView(&view)) {
+    Resample(view, source.width(), source.height(), width, height, argb);
+    return;
+  }
+  std::vector<unsigned char> row(size_t(source.width()) * 4);
+  Start(source.width(), source.height(), width, height, argb);
+  for (int y = 0; y < source.height(); ++y) {
+    source.provideARGB(0, y, source.width(), 1, row.data());
+    AddRow(row.data(), kPixelFormatARGB);
+  }
+  assert(next_target_row_ == height || horizontal_ == nullptr);
+}
@@ -0,0 +1,81 @@
+/*
+ *  iconResampler.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_ICON_RESAMPLER
+#define XKBGROWL_ICON_RESAMPLER
+
+#include <map>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+#include "x11Util.h"
+
+enum ResampleFilter {
+  kLanczosFilter,  // Lanczos, three lobes: sharp, the default.
+  kBoxFilter       // Area average when shrinking, blocky when enlarging.
+};
+
+// Size of a width × height image once scaled to fit in a size × size square,
+// keeping its aspect ratio.
+void FitIconSize(int width, int height, int size, int* fit_width, int* fit_height);
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Separable image scaler. Pixels are converted to premultiplied floats,
+// scaled horizontally then vertically, four channels at a time. Filter
+// weights are computed once per source and target size pair. Source rows are
+// consumed one at a time: only the rows covered by the vertical filter are
+// kept, whatever the size of the source.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class IconResampler {
+public:
+  explicit IconResampler(ResampleFilter filter);
+  // Scales the source × source_height pixels of source to width × height,
+  // written as 4 × width × height A, R, G, B bytes, non premultiplied.
+  void Resample(const PixelView& source, int source_width, int source_height,
+                int width, int height, unsigned char* argb);
+  // Same for the pixels of an image proxy. Images that are not held in
+  // memory are converted one row at a time, never as a whole.
+  void Resample(const ImageProxy& source, int width, int height, unsigned char* argb);
+private:
+  // Coefficients of the source pixels contributing to each target pixel.
+  struct Weights {
+    int taps;                         // Coefficients per target pixel.
+    std::vector<int> first;           // First source pixel, per target pixel.
+    std::vector<float> coefficients;  // taps coefficients per target pixel.
+  };
+  const Weights& WeightsFor(int source, int target);
+  void ComputeWeights(int source, int target, Weights* weights) const;
+  // Prepares the scaling of a source_width × source_height image.
+  void Start(int source_width, int source_height, int width, int height, unsigned char* argb);
+  // Adds the next source row, writes the target rows that are complete.
+  void AddRow(const unsigned char* row, PixelFormat format);
+  // Blends the rows of the ring into target row y.
+  void WriteRow(int y);
+
+  const ResampleFilter filter_;
+  std::map<std::pair<int, int>, Weights> weights_;
+  // State of the current scaling, set by Start.
+  int source_width_;
+  int width_;
+  int height_;
+  unsigned char* argb_;              // Target pixels.
+  const Weights* horizontal_;        // null if the image is not scaled.
+  const Weights* vertical_;
+  int next_source_row_;
+  int next_target_row_;
+  std::vector<unsigned char> argb_row_;  // One source row, as A, R, G, B bytes.
+  std::vector<float> row_;               // Same, premultiplied.
+  std::vector<float> ring_;              // Last vertical taps source rows, scaled horizontally.
+  std::vector<float> output_row_;
+};
+
+#endif
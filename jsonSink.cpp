@@ -0,0 +1,234 @@
+/*
+ *  jsonSink.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "jsonSink.h"
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const char kJsonOpenError[] = "Could not open %s: %s\n";
+const char kSocketError[] = "Could not listen on %s: %s\n";
+const char kSocketSendError[] = "Could not write to a client of %s: %s\n";
+const char kSocketStatisticsFormat[] = "Socket %s: %zu clients disconnected\n";
+const char kBase64Digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#ifdef MSG_NOSIGNAL
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;  // SIGPIPE is ignored by the daemon.
+#endif
+
+// ─────────────────────────────────────────────────────────────────────────────
+// JSON formatting
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Quoted JSON string.
+static void AppendJsonString(const std::string& value, std::string* json) {
+  json->push_back('"');
+  const std::string text = ToUtf8(value);
+  for (size_t i = 0; i < text.size(); ++i) {
+    const unsigned char c = text[i];
+    if (c == '"' || c == '\\') {
+      json->push_back('\\');
+      json->push_back(c);
+    } else if (c < 0x20) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      json->append(escape);
+    } else {
+      json->push_back(c);
+    }
+  }
+  json->push_back('"');
+}
+
+static void AppendBase64(const IconBlob& data, std::string* json) {
+  size_t i = 0;
+  for (; i + 3 <= data.size(); i += 3) {
+    const uint32_t group = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+    json->push_back(kBase64Digits[group >> 18]);
+    json->push_back(kBase64Digits[(group >> 12) & 0x3f]);
+    json->push_back(kBase64Digits[(group >> 6) & 0x3f]);
+    json->push_back(kBase64Digits[group & 0x3f]);
+  }
+  if (i < data.size()) {
+    const bool two = i + 1 < data.size();
+    const uint32_t group = (data[i] << 16) | (two ? data[i + 1] << 8 : 0);
+    json->push_back(kBase64Digits[group >> 18]);
+    json->push_back(kBase64Digits[(group >> 12) & 0x3f]);
+    json->push_back(two ? kBase64Digits[(group >> 6) & 0x3f] : '=');
+    json->push_back('=');
+  }
+}
+
+static void AppendField(const char* name, const std::string& value, std::string* json) {
+  json->append(",\"").append(name).append("\":");
+  AppendJsonString(value, json);
+}
+
+static void AppendField(const char* name, long long value, std::string* json) {
+  json->append(",\"").append(name).append("\":").append(std::to_string(value));
+}
+
+std::string FormatJsonNotification(const BellEvent& event, size_t count, const IconBlob* icon,
+                                   IconEncoding encoding) {
+  const long long now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  std::string json = "{\"time_ms\":" + std::to_string(now);
+  AppendField("display", event.displayName(), &json);
+  AppendField("name", event.name(), &json);
+  AppendField("window", static_cast<long long>(event.window()), &json);
+  AppendField("window_name", event.windowName(), &json);
+  AppendField("host", event.hostName(), &json);
+  AppendField("text", NotificationText(event, count), &json);
+  AppendField("count", static_cast<long long>(count), &json);
+  AppendField("percent", event.percent(), &json);
+  AppendField("pitch", event.pitch(), &json);
+  AppendField("duration", event.duration(), &json);
+  AppendField("bell_class", event.bellClass(), &json);
+  AppendField("bell_id", event.bellId(), &json);
+  if (icon != nullptr) {
+    AppendField("icon_format", IconEncodingName(encoding), &json);
+    json.append(",\"icon\":\"");
+    AppendBase64(*icon, &json);
+    json.push_back('"');
+  }
+  json.push_back('}');
+  return json;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// JSON lines file
+// ─────────────────────────────────────────────────────────────────────────────
+
+JsonLinesSink* JsonLinesSink::Create(const std::string& path, IconEncoding encoding) {
+  if (path.empty()) {
+    return new JsonLinesSink(stdout, false, encoding);
+  }
+  FILE* const file = fopen(path.c_str(), "a");
+  if (file == nullptr) {
+    fprintf(stderr, kJsonOpenError, path.c_str(), strerror(errno));
+    return nullptr;
+  }
+  return new JsonLinesSink(file, true, encoding);
+}
+
+JsonLinesSink::JsonLinesSink(FILE* file, bool owned, IconEncoding encoding)
+: file_(file), owned_(owned), encoding_(encoding) {}
+
+JsonLinesSink::~JsonLinesSink() {
+  if (owned_) {
+    fclose(file_);
+  }
+}
+
+bool JsonLinesSink::Post(const BellEvent& event, size_t count, const IconBlob* icon) {
+  const std::string line = FormatJsonNotification(event, count, icon, encoding_) + "\n";
+  // One line per notification, readers never see half an object.
+  return fwrite(line.data(), 1, line.size(), file_) == line.size() && fflush(file_) == 0;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Unix domain socket
+// ─────────────────────────────────────────────────────────────────────────────
+
+UnixSocketSink* UnixSocketSink::Create(const std::string& path, IconEncoding encoding) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  if (path.size() >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+    return nullptr;
+  }
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, path.c_str(), path.size());
+  const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    fprintf(stderr, kSocketError, path.c_str(), strerror(errno));
+    return nullptr;
+  }
+  unlink(path.c_str());
+  if (bind(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) ||
+      listen(listener, SOMAXCONN) ||
+      fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK)) {
+    fprintf(stderr, kSocketError, path.c_str(), strerror(errno));
+    close(listener);
+    return nullptr;
+  }
+  return new UnixSocketSink(listener, path, encoding);
+}
+
+UnixSocketSink::UnixSocketSink(int listener, const std::string& path, IconEncoding encoding)
+: listener_(listener), path_(path), encoding_(encoding), disconnected_(0) {}
+
+UnixSocketSink::~UnixSocketSink() {
+  for (size_t i = 0; i < clients_.size(); ++i) {
+    close(clients_[i]);
+  }
+  close(listener_);
+  unlink(path_.c_str());
+}
+
+void UnixSocketSink::AcceptClients() {
+  while (true) {
+    const int client = accept(listener_, nullptr, nullptr);
+    if (client < 0) {
+      return;
+    }
+    fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+    clients_.push_back(client);
+  }
+}
+
+// Whether a failed send is the doing of the client: it went away, or its
+// socket buffer is full.
+static bool IsClientError(int error) {
+  return error == EAGAIN || error == EWOULDBLOCK || error == EPIPE || error == ECONNRESET ||
+      error == ENOTCONN;
+}
+
+bool UnixSocketSink::Post(const BellEvent& event, size_t count, const IconBlob* icon) {
+  AcceptClients();
+  if (clients_.empty()) {
+    return true;
+  }
+  const std::string line = FormatJsonNotification(event, count, icon, encoding_) + "\n";
+  bool delivered = true;
+  for (size_t i = 0; i < clients_.size();) {
+    const ssize_t written = send(clients_[i], line.data(), line.size(), kSendFlags);
+    if (written == static_cast<ssize_t>(line.size())) {
+      ++i;
+      continue;
+    }
+    if (written < 0 && !IsClientError(errno)) {
+      // Nothing was written, the client can stay.
+      fprintf(stderr, kSocketSendError, path_.c_str(), strerror(errno));
+      delivered = false;
+      ++i;
+      continue;
+    }
+    // Gone, or too slow: a partial line cannot be completed later without
+    // buffering, the client is dropped.
+    close(clients_[i]);
+    clients_.erase(clients_.begin() + i);
+    ++disconnected_;
+  }
+  return delivered;
+}
+
+void UnixSocketSink::PrintStatistics(FILE* file) const {
+  fprintf(file, kSocketStatisticsFormat, path_.c_str(),
+          disconnected_.load(std::memory_order_relaxed));
+}
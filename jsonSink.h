@@ -0,0 +1,74 @@
+/*
+ *  jsonSink.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_JSON_SINK
+#define XKBGROWL_JSON_SINK
+
+#include <atomic>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "notificationSink.h"
+
+// One JSON object, without line feed, describing the notification: the
+// event fields, the text, the count and the base64 encoded icon if any.
+std::string FormatJsonNotification(const BellEvent& event, size_t count, const IconBlob* icon,
+                                   IconEncoding encoding);
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Writes one JSON object per line to a file or to the standard output.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class JsonLinesSink : public NotificationSink {
+public:
+  // Appends to path, or writes to the standard output if path is empty.
+  static JsonLinesSink* Create(const std::string& path, IconEncoding encoding);
+  ~JsonLinesSink();
+  const char* name() const { return "json"; }
+  IconEncoding iconEncoding() const { return encoding_; }
+  bool Post(const BellEvent& event, size_t count, const IconBlob* icon);
+private:
+  JsonLinesSink(FILE* file, bool owned, IconEncoding encoding);
+
+  FILE* const file_;
+  const bool owned_;  // file_ is closed by the destructor.
+  const IconEncoding encoding_;
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Streams the same JSON lines to the clients of a Unix domain socket. Clients
+// are accepted as notifications are posted; a client that does not keep up,
+// that is whose socket buffer is full, is disconnected.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class UnixSocketSink : public NotificationSink {
+public:
+  // Listens on path, replacing any stale socket.
+  static UnixSocketSink* Create(const std::string& path, IconEncoding encoding);
+  ~UnixSocketSink();
+  const char* name() const { return "socket"; }
+  IconEncoding iconEncoding() const { return encoding_; }
+  // Only fails if the line could not be written for a reason that is not
+  // the client's; disconnected clients are counted apart.
+  bool Post(const BellEvent& event, size_t count, const IconBlob* icon);
+  void PrintStatistics(FILE* file) const;
+private:
+  UnixSocketSink(int listener, const std::string& path, IconEncoding encoding);
+  void AcceptClients();
+
+  const int listener_;
+  const std::string path_;
+  const IconEncoding encoding_;
+  std::vector<int> clients_;
+  std::atomic<size_t> disconnected_;  // Clients dropped, gone or too slow.
+};
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ *  latencyHistogram.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "latencyHistogram.h"
+#include <string.h>
+
+const char kHistogramFormat[] = "%s latency: %zu samples, p50 %s, p90 %s, p99 %s;";
+const char kEmptyHistogramFormat[] = "%s latency: no samples\n";
+const double kPercentiles[] = { 0.5, 0.9, 0.99 };
+
+LatencyHistogram::LatencyHistogram() : count_(0) {
+  memset(buckets_, 0, sizeof(buckets_));
+}
+
+void LatencyHistogram::Record(std::chrono::steady_clock::duration latency) {
+  const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(latency).count();
+  int bucket = 0;
+  while (bucket < kBuckets - 1 && ms >= (1LL << bucket)) {
+    ++bucket;
+  }
+  ++buckets_[bucket];
+  ++count_;
+}
+
+long LatencyHistogram::Percentile(double fraction) const {
+  // Smallest bucket such that at least fraction of the samples are in it or below.
+  size_t seen = 0;
+  for (int bucket = 0; bucket < kBuckets - 1; ++bucket) {
+    seen += buckets_[bucket];
+    if (seen > 0 && seen >= fraction * count_) {
+      return 1L << bucket;
+    }
+  }
+  return -1;
+}
+
+// Bound of a bucket, "< 8 ms" or "≥ 4096 ms".
+static void FormatBound(long bound, char* text, size_t size) {
+  if (bound < 0) {
+    snprintf(text, size, "≥ %ld ms", 1L << (LatencyHistogram::kBuckets - 2));
+  } else {
+    snprintf(text, size, "< %ld ms", bound);
+  }
+}
+
+void LatencyHistogram::Print(FILE* file, const char* name) const {
+  if (count_ == 0) {
+    fprintf(file, kEmptyHistogramFormat, name);
+    return;
+  }
+  char bounds[3][32];
+  for (int i = 0; i < 3; ++i) {
+    FormatBound(Percentile(kPercentiles[i]), bounds[i], sizeof(bounds[i]));
+  }
+  fprintf(file, kHistogramFormat, name, count_, bounds[0], bounds[1], bounds[2]);
+  for (int bucket = 0; bucket < kBuckets; ++bucket) {
+    if (buckets_[bucket] == 0) {
+      continue;
+    }
+    char bound[32];
+    FormatBound(bucket < kBuckets - 1 ? 1L << bucket : -1, bound, sizeof(bound));
+    fprintf(file, " %s: %zu", bound, buckets_[bucket]);
+  }
+  fputc('\n', file);
+}
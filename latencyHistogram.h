@@ -0,0 +1,39 @@
+/*
+ *  latencyHistogram.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_LATENCY_HISTOGRAM
+#define XKBGROWL_LATENCY_HISTOGRAM
+#include <chrono>
+#include <stddef.h>
+#include <stdio.h>
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Counts durations in buckets whose bounds are powers of two milliseconds:
+// below 1 ms, below 2 ms, … below 4096 ms, and longer. Not thread safe.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class LatencyHistogram {
+public:
+  static const int kBuckets = 14;
+
+  LatencyHistogram();
+  void Record(std::chrono::steady_clock::duration latency);
+  size_t count() const { return count_; }
+  // Upper bound, in ms, of the bucket that holds the given fraction of the
+  // samples, -1 if that bucket has no bound.
+  long Percentile(double fraction) const;
+  // One line: percentiles, then the count of each bucket that is not empty.
+  void Print(FILE* file, const char* name) const;
+private:
+  size_t buckets_[kBuckets];
+  size_t count_;
+};
+
+#endif
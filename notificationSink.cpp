@@ -0,0 +1,426 @@
+/*
+ *  notificationSink.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "notificationSink.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "dbusSink.h"
+#include "jsonSink.h"
+#include "latencyHistogram.h"
+
+const char kNoHostnameError[] = "Could not retrieve hostname";
+const char kUnknownSinkError[] = "Unknown notification sink: %s\n";
+const char kWorkerStatisticsFormat[] =
+    "Sink %s: %s, %zu posted, %zu failed, %zu dropped, %zu skipped, %zu queued\n";
+const char kDispatcherStatisticsFormat[] = "Dispatcher: %zu notifications\n";
+const char kDegradedFormat[] = "Sink %s missed %d deadlines, notifications are skipped\n";
+const char kRecoveredFormat[] = "Sink %s recovered\n";
+const char kJsonSinkName[] = "json";
+const char kSocketSinkName[] = "socket";
+const char kDbusSinkName[] = "dbus";
+const size_t kARGBBytes = 4;
+// Number of icon sources whose pixel hash is remembered.
+const size_t kImageHashCapacity = 256;
+// Consecutive deadlines a sink misses before it is marked degraded.
+const int kDegradedMisses = 3;
+
+static std::string LocalHostName() {
+  char hostname[256];
+  if (gethostname(&hostname[0], sizeof(hostname))) {
+    perror(kNoHostnameError);
+    return std::string();
+  }
+  hostname[sizeof(hostname) - 1] = '\0';
+  return hostname;
+}
+
+std::string NotificationText(const BellEvent& event, size_t count) {
+  static const std::string local_host = LocalHostName();
+  std::string text = event.name();
+  // If there is a window name, prepend it to the notification text
+  if (!event.windowName().empty()) {
+    text = event.windowName() + ": " + text;
+  }
+  const std::string& host = event.hostName();
+  if (!host.empty() && host != local_host) {
+    text = host + ": " + text;
+  }
+  if (count > 1) {
+    text += " (×" + std::to_string(count) + ")";
+  }
+  return text;
+}
+
+// Length of the valid UTF-8 sequence at text, 0 if there is none.
+static size_t Utf8Length(const unsigned char* text, size_t available) {
+  const unsigned char lead = text[0];
+  size_t length = 0;
+  if (lead >= 0xc2 && lead <= 0xdf) {
+    length = 2;
+  } else if (lead >= 0xe0 && lead <= 0xef) {
+    length = 3;
+  } else if (lead >= 0xf0 && lead <= 0xf4) {
+    length = 4;
+  }
+  if (length == 0 || length > available) {
+    return 0;
+  }
+  for (size_t i = 1; i < length; ++i) {
+    if ((text[i] & 0xc0) != 0x80) {
+      return 0;
+    }
+  }
+  return length;
+}
+
+std::string ToUtf8(const std::string& text) {
+  const unsigned char* const bytes = reinterpret_cast<const unsigned char*>(text.data());
+  std::string result;
+  result.reserve(text.size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    const unsigned char c = bytes[i];
+    if (c < 0x80) {
+      result.push_back(c);
+      continue;
+    }
+    const size_t length = Utf8Length(bytes + i, text.size() - i);
+    if (length > 0) {
+      result.append(text, i, length);
+      i += length - 1;
+    } else {
+      result.push_back(static_cast<char>(0xc0 | (c >> 6)));
+      result.push_back(static_cast<char>(0x80 | (c & 0x3f)));
+    }
+  }
+  return result;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Sink factory
+// ─────────────────────────────────────────────────────────────────────────────
+
+NotificationSink* CreateNotificationSink(const std::string& spec, IconEncoding encoding) {
+  const size_t colon = spec.find(':');
+  const std::string kind = spec.substr(0, colon);
+  const std::string argument = colon == std::string::npos ? "" : spec.substr(colon + 1);
+  if (kind == kJsonSinkName) {
+    return JsonLinesSink::Create(argument, encoding);
+  }
+  if (kind == kSocketSinkName && !argument.empty()) {
+    return UnixSocketSink::Create(argument, encoding);
+  }
+  if (kind == kDbusSinkName && argument.empty()) {
+    return DbusSink::Create();
+  }
+  fprintf(stderr, kUnknownSinkError, spec.c_str());
+  return nullptr;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Sink workers
+// ─────────────────────────────────────────────────────────────────────────────
+
+typedef std::chrono::steady_clock Clock;
+
+// A bell ready to be shown: the event and its icon in every encoding a sink
+// asked for. Shared by all the workers, never modified once queued.
+struct Notification {
+  std::unique_ptr<const BellEvent> event;
+  size_t count;
+  std::shared_ptr<const IconBlob> icons[kNumIconEncodings];
+  Clock::time_point queued;
+};
+
+class SinkWorker {
+public:
+  SinkWorker(NotificationSink* sink, size_t capacity, int deadline);
+  // Posts the queued notifications, then stops the thread.
+  ~SinkWorker();
+  const NotificationSink& sink() const { return *sink_; }
+  // Whether notifications should be queued now. A degraded sink only gets
+  // one when it is idle, to find out whether it recovered.
+  bool Accepts(Clock::time_point now);
+  // Queues notification, dropping the oldest one if the queue is full.
+  void Enqueue(const std::shared_ptr<const Notification>& notification);
+  void PrintStatistics(FILE* file) const;
+private:
+  SinkWorker(const SinkWorker&);
+  SinkWorker& operator=(const SinkWorker&);
+  void Run();
+  // Called with the lock held.
+  void Degrade();
+  // Counts the deadlines the post in flight missed elapsed after its
+  // notification was dispatched, minus those already counted. Called with
+  // the lock held.
+  void ChargeMisses(Clock::duration elapsed);
+
+  const std::unique_ptr<NotificationSink> sink_;
+  const size_t capacity_;
+  const Clock::duration deadline_;
+  mutable std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::deque<std::shared_ptr<const Notification> > queue_;
+  bool stopping_;
+  bool busy_;                 // A notification is being posted…
+  Clock::time_point queued_;  // … that was dispatched then…
+  int charged_;               // … and already counted this many misses.
+  int misses_;                // Deadlines missed since the last post in time.
+  bool degraded_;
+  size_t posted_;
+  size_t failed_;
+  size_t dropped_;  // Pushed out of a full queue.
+  size_t skipped_;  // Not queued, or discarded, because the sink is degraded.
+  LatencyHistogram latency_;  // From dispatch to the end of the post.
+  std::thread thread_;  // Started last, once everything else is built.
+};
+
+SinkWorker::SinkWorker(NotificationSink* sink, size_t capacity, int deadline)
+: sink_(sink), capacity_(capacity > 0 ? capacity : 1),
+  deadline_(std::chrono::milliseconds(deadline)), stopping_(false), busy_(false), charged_(0), misses_(0),
+  degraded_(false), posted_(0), failed_(0), dropped_(0), skipped_(0),
+  thread_(&SinkWorker::Run, this) {}
+
+SinkWorker::~SinkWorker() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  not_empty_.notify_one();
+  thread_.join();
+}
+
+void SinkWorker::Degrade() {
+  degraded_ = true;
+  fprintf(stderr, kDegradedFormat, sink_->name(), misses_);
+  // What is queued would only be shown late.
+  skipped_ += queue_.size();
+  queue_.clear();
+}
+
+void SinkWorker::ChargeMisses(Clock::duration elapsed) {
+  // A post counts one miss per deadline elapsed, whether it returned or not.
+  const int missed = static_cast<int>(elapsed / deadline_);
+  if (missed > charged_) {
+    misses_ += missed - charged_;
+    charged_ = missed;
+  }
+  if (!degraded_ && misses_ >= kDegradedMisses) {
+    Degrade();
+  }
+}
+
+bool SinkWorker::Accepts(Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // A post that does not return is charged the deadlines it already missed.
+  if (busy_ && deadline_.count() > 0) {
+    ChargeMisses(now - queued_);
+  }
+  if (degraded_ && (busy_ || !queue_.empty())) {
+    ++skipped_;
+    return false;
+  }
+  return true;
+}
+
+void SinkWorker::Enqueue(const std::shared_ptr<const Notification>& notification) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (queue_.size() >= capacity_) {
+      queue_.pop_front();
+      ++dropped_;
+    }
+    queue_.push_back(notification);
+  }
+  not_empty_.notify_one();
+}
+
+void SinkWorker::Run() {
+  const IconEncoding encoding = sink_->iconEncoding();
+  while (true) {
+    std::shared_ptr<const Notification> notification;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (queue_.empty() && !stopping_) {
+        not_empty_.wait(lock);
+      }
+      if (queue_.empty()) {
+        return;
+      }
+      notification = std::move(queue_.front());
+      queue_.pop_front();
+      busy_ = true;
+      queued_ = notification->queued;
+      charged_ = 0;
+    }
+    const bool delivered = sink_->Post(*notification->event, notification->count,
+                                       notification->icons[encoding].get());
+    const Clock::duration latency = Clock::now() - notification->queued;
+    std::lock_guard<std::mutex> lock(mutex_);
+    busy_ = false;
+    ++(delivered ? posted_ : failed_);
+    latency_.Record(latency);
+    if (deadline_.count() > 0 && latency >= deadline_) {
+      ChargeMisses(latency);
+    } else {
+      misses_ = 0;
+      if (degraded_) {
+        degraded_ = false;
+        fprintf(stderr, kRecoveredFormat, sink_->name());
+      }
+    }
+  }
+}
+
+void SinkWorker::PrintStatistics(FILE* file) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  fprintf(file, kWorkerStatisticsFormat, sink_->name(), degraded_ ? "degraded" : "healthy",
+          posted_, failed_, dropped_, skipped_, queue_.size());
+  latency_.Print(file, sink_->name());
+  sink_->PrintStatistics(file);
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Dispatcher
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Hash of the pixels of an image. Pixels held in memory are hashed in place,
+// the others are converted to ARGB one row at a time. Only the pixels of each
+// row are hashed, not the padding up to the stride, which is undefined.
+static uint64_t HashImage(const ImageProxy& image) {
+  const int width = image.width();
+  const int height = image.height();
+  const size_t row_bytes = size_t(width) * kARGBBytes;
+  PixelView view;
+  if (image.pixelView(&view)) {
+    uint64_t hash = view.format;
+    for (int y = 0; y < height; ++y) {
+      hash = HashPixels(view.data + y * view.stride, row_bytes, hash);
+    }
+    return hash;
+  }
+  std::vector<unsigned char> row(row_bytes);
+  uint64_t hash = kPixelFormatARGB;
+  for (int y = 0; y < height; ++y) {
+    image.provideARGB(0, y, width, 1, row.data());
+    hash = HashPixels(row.data(), row.size(), hash);
+  }
+  return hash;
+}
+
+// Key of the source of the icon of event: its display, its window and the
+// generation of the proxy. Fields are separated by a character that cannot
+// appear in any of them.
+static std::string IconSourceKey(const BellEvent& event, const ImageProxy& image) {
+  return event.displayName() + '\0' + std::to_string(event.window()) + '\0' +
+      std::to_string(image.generation());
+}
+
+NotificationDispatcher::NotificationDispatcher(size_t icon_cache_budget, ResampleFilter filter,
+                                               size_t queue_capacity, int deadline)
+: queue_capacity_(queue_capacity), deadline_(deadline), icon_cache_(icon_cache_budget),
+  resampler_(filter), dispatched_(0) {}
+
+NotificationDispatcher::~NotificationDispatcher() {}
+
+void NotificationDispatcher::AddSink(NotificationSink* sink) {
+  workers_.push_back(std::unique_ptr<SinkWorker>(new SinkWorker(sink, queue_capacity_, deadline_)));
+}
+
+uint64_t NotificationDispatcher::ImageHash(const BellEvent& event, const ImageProxy& image) {
+  const std::string source = IconSourceKey(event, image);
+  std::unordered_map<std::string, uint64_t>::const_iterator found = image_hashes_.find(source);
+  if (found != image_hashes_.end()) {
+    return found->second;
+  }
+  // Entries of icons that changed are never looked up again, so the map is
+  // simply emptied when full.
+  if (image_hashes_.size() >= kImageHashCapacity) {
+    image_hashes_.clear();
+  }
+  const uint64_t hash = HashImage(image);
+  image_hashes_[source] = hash;
+  return hash;
+}
+
+std::shared_ptr<const IconBlob> NotificationDispatcher::Icon(const BellEvent& event,
+                                                             const ImageProxy& image,
+                                                             IconEncoding encoding,
+                                                             bool* hashed, uint64_t* hash) {
+  if (!*hashed) {
+    *hash = ImageHash(event, image);
+    *hashed = true;
+  }
+  const IconKey key = { *hash, image.width(), image.height(), kNotificationIconSize, encoding };
+  std::shared_ptr<const IconBlob> blob = icon_cache_.Lookup(key);
+  if (blob != nullptr) {
+    return blob;
+  }
+  // The source pixels are never converted as a whole: large icons only
+  // ever have a few rows in memory, see IconResampler.
+  int icon_width = 0;
+  int icon_height = 0;
+  FitIconSize(image.width(), image.height(), kNotificationIconSize, &icon_width, &icon_height);
+  std::vector<unsigned char> pixels(size_t(icon_width) * icon_height * kARGBBytes);
+  resampler_.Resample(image, icon_width, icon_height, pixels.data());
+  std::shared_ptr<IconBlob> encoded = std::make_shared<IconBlob>();
+  if (!EncodeIcon(pixels.data(), icon_width, icon_height, encoding, encoded.get())) {
+    return nullptr;
+  }
+  icon_cache_.Insert(key, encoded);
+  return encoded;
+}
+
+void NotificationDispatcher::Post(std::unique_ptr<BellEvent> event, size_t count) {
+  const Clock::time_point now = Clock::now();
+  std::vector<SinkWorker*> accepting;
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    if (workers_[i]->Accepts(now)) {
+      accepting.push_back(workers_[i].get());
+    }
+  }
+  if (accepting.empty()) {
+    return;
+  }
+  std::shared_ptr<Notification> notification = std::make_shared<Notification>();
+  // Icons are only converted for the encodings the accepting sinks use.
+  const ImageProxy* const image = event->imageProxy();
+  if (image != nullptr) {
+    bool hashed = false;
+    uint64_t hash = 0;
+    for (size_t i = 0; i < accepting.size(); ++i) {
+      const IconEncoding encoding = accepting[i]->sink().iconEncoding();
+      if (notification->icons[encoding] == nullptr) {
+        notification->icons[encoding] = Icon(*event, *image, encoding, &hashed, &hash);
+      }
+    }
+  }
+  notification->event = std::move(event);
+  notification->count = count;
+  notification->queued = now;
+  const std::shared_ptr<const Notification> shared = notification;
+  for (size_t i = 0; i < accepting.size(); ++i) {
+    accepting[i]->Enqueue(shared);
+  }
+  ++dispatched_;
+}
+
+void NotificationDispatcher::PrintStatistics(FILE* file) const {
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    workers_[i]->PrintStatistics(file);
+  }
+  fprintf(file, kDispatcherStatisticsFormat, dispatched_);
+  icon_cache_.PrintStatistics(file);
+}
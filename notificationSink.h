@@ -0,0 +1,112 @@
+/*
+ *  notificationSink.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_NOTIFICATION_SINK
+#define XKBGROWL_NOTIFICATION_SINK
+
+#include <memory>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "iconCache.h"
+#include "iconEncoder.h"
+#include "iconResampler.h"
+#include "x11Util.h"
+
+// Notification text for event standing for count bells: the bell name,
+// prefixed by the window name and the host if it is not the local one,
+// followed by the count if there is more than one bell.
+std::string NotificationText(const BellEvent& event, size_t count);
+
+// X11 strings are either UTF-8 or iso-latin1: returns text as valid UTF-8,
+// bytes that are not part of a UTF-8 sequence are taken as latin1 characters.
+std::string ToUtf8(const std::string& text);
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Destination of the notifications: a notification server, a file, a
+// socket… Each sink is called from its own worker thread, see SinkWorker.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class NotificationSink {
+public:
+  virtual ~NotificationSink() {}
+  // Short name, as used on the command line.
+  virtual const char* name() const = 0;
+  // Format of the icons passed to Post.
+  virtual IconEncoding iconEncoding() const = 0;
+  // Shows event, standing for count identical bells. icon is the encoded
+  // window icon, null if the event has none. Returns false if the
+  // notification could not be delivered.
+  virtual bool Post(const BellEvent& event, size_t count, const IconBlob* icon) = 0;
+  // Counters of the sink itself, if any. Called from any thread.
+  virtual void PrintStatistics(FILE* /*file*/) const {}
+};
+
+// Builds the sink described by spec, "dbus", "json", "json:FILE" or
+// "socket:PATH". Sinks that accept any icon format use encoding. Returns
+// null, after printing why, if the sink cannot be built.
+NotificationSink* CreateNotificationSink(const std::string& spec, IconEncoding encoding);
+
+// Default number of notifications waiting for each sink.
+const size_t kDefaultSinkQueueCapacity = 64;
+// Default time, in milliseconds, within which a sink should show a notification.
+const int kDefaultSinkDeadline = 2000;
+
+class SinkWorker;
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Posts every notification to all the sinks. Icons are converted once per
+// encoding, and cached by content. Each sink has its own thread and bounded
+// queue, fed with a single read-only copy of the notification, so a slow or
+// hung sink never delays the others. A sink that keeps missing its deadline
+// is marked degraded: it is then only given a notification when it is idle,
+// until one is shown in time again.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class NotificationDispatcher {
+public:
+  // Each sink can have queue_capacity notifications waiting, and should show
+  // them within deadline ms.
+  NotificationDispatcher(size_t icon_cache_budget, ResampleFilter filter, size_t queue_capacity,
+                         int deadline);
+  // Posts the notifications still queued, then stops the workers.
+  ~NotificationDispatcher();
+  // Adds a sink, takes ownership and starts its worker.
+  void AddSink(NotificationSink* sink);
+  size_t sinks() const { return workers_.size(); }
+  // Queues event, standing for count bells, for all the sinks.
+  void Post(std::unique_ptr<BellEvent> event, size_t count);
+  // Counters and latency histogram of each sink.
+  void PrintStatistics(FILE* file) const;
+private:
+  NotificationDispatcher(const NotificationDispatcher&);
+  NotificationDispatcher& operator=(const NotificationDispatcher&);
+  // Hash of the pixels of image, the icon of event. The pixels are only read
+  // the first time an icon source is seen.
+  uint64_t ImageHash(const BellEvent& event, const ImageProxy& image);
+  // Icon of image in encoding, from the cache if possible. hash is the hash
+  // of the image pixels, computed on first use.
+  std::shared_ptr<const IconBlob> Icon(const BellEvent& event, const ImageProxy& image,
+                                       IconEncoding encoding, bool* hashed, uint64_t* hash);
+
+  const size_t queue_capacity_;
+  const int deadline_;
+  std::vector<std::unique_ptr<SinkWorker> > workers_;
+  IconCache icon_cache_;
+  // Pixel hash of the icon sources recently posted, see IconSourceKey.
+  std::unordered_map<std::string, uint64_t> image_hashes_;
+  IconResampler resampler_;
+  size_t dispatched_;
+};
+
+#endif
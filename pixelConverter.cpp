@@ -0,0 +1,250 @@
+/*
+ *  pixelConverter.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "pixelConverter.h"
+#include <assert.h>
+#include <algorithm>
+#include <string.h>
+#include <X11/Xutil.h>
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Row decoders, one instance per pixel size and byte order.
+// ─────────────────────────────────────────────────────────────────────────────
+
+template <int kBitsPerPixel, bool kMsbFirst>
+struct PixelReader;
+
+template <bool kMsbFirst>
+struct PixelReader<1, kMsbFirst> {
+  static uint32_t Read(const unsigned char* row, int x) {
+    const unsigned char byte = row[x >> 3];
+    return kMsbFirst ? (byte >> (7 - (x & 7))) & 1 : (byte >> (x & 7)) & 1;
+  }
+};
+
+template <bool kMsbFirst>
+struct PixelReader<8, kMsbFirst> {
+  static uint32_t Read(const unsigned char* row, int x) {
+    return row[x];
+  }
+};
+
+template <bool kMsbFirst>
+struct PixelReader<16, kMsbFirst> {
+  static uint32_t Read(const unsigned char* row, int x) {
+    const unsigned char* const p = row + 2 * x;
+    return kMsbFirst ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+  }
+};
+
+template <bool kMsbFirst>
+struct PixelReader<24, kMsbFirst> {
+  static uint32_t Read(const unsigned char* row, int x) {
+    const unsigned char* const p = row + 3 * x;
+    return kMsbFirst ? (p[0] << 16) | (p[1] << 8) | p[2] : (p[2] << 16) | (p[1] << 8) | p[0];
+  }
+};
+
+template <bool kMsbFirst>
+struct PixelReader<32, kMsbFirst> {
+  static uint32_t Read(const unsigned char* row, int x) {
+    const unsigned char* const p = row + 4 * x;
+    return kMsbFirst ?
+        (uint32_t(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3] :
+        (uint32_t(p[3]) << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+  }
+};
+
+template <int kBitsPerPixel, bool kMsbFirst>
+void DecodeRowOf(const unsigned char* row, int x, int width, uint32_t* values) {
+  for (int i = 0; i < width; ++i) {
+    values[i] = PixelReader<kBitsPerPixel, kMsbFirst>::Read(row, x + i);
+  }
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+const bool kHostMsbFirst = false;
+#else
+const bool kHostMsbFirst = true;
+#endif
+
+// Pixels in host order need no decoding.
+static void CopyRow32(const unsigned char* row, int x, int width, uint32_t* values) {
+  memcpy(values, row + 4 * x, width * sizeof(uint32_t));
+}
+
+template <bool kMsbFirst>
+RowDecoder::DecodeFunction DecoderForSize(int bits_per_pixel) {
+  switch (bits_per_pixel) {
+    case 1: return &DecodeRowOf<1, kMsbFirst>;
+    case 8: return &DecodeRowOf<8, kMsbFirst>;
+    case 16: return &DecodeRowOf<16, kMsbFirst>;
+    case 24: return &DecodeRowOf<24, kMsbFirst>;
+    case 32: return kMsbFirst == kHostMsbFirst ? &CopyRow32 : &DecodeRowOf<32, kMsbFirst>;
+    default: return nullptr;
+  }
+}
+
+RowDecoder::RowDecoder(XImage* image)
+: image_(image), decode_(nullptr), x_offset_(0), depth_mask_(0xffffffff) {
+  assert(image != nullptr);
+  if (image->depth == 1 && image->bits_per_pixel == 1) {
+    // XGetPixel treats single bit images as bitmaps, whatever their format.
+    // Bits can be addressed one byte at a time as long as the bytes of a
+    // bitmap unit are in the same order as the bits.
+    if (image->bitmap_unit == 8 || image->byte_order == image->bitmap_bit_order) {
+      decode_ = image->bitmap_bit_order == MSBFirst ?
+          DecoderForSize<true>(1) : DecoderForSize<false>(1);
+      x_offset_ = image->xoffset;
+    }
+  } else if (image->format == ZPixmap && image->bits_per_pixel >= 8) {
+    decode_ = image->byte_order == MSBFirst ?
+        DecoderForSize<true>(image->bits_per_pixel) :
+        DecoderForSize<false>(image->bits_per_pixel);
+    if (image->depth < 32) {
+      depth_mask_ = (uint32_t(1) << image->depth) - 1;
+    }
+  }
+  assert(image->height == 0 || VerifyRow(0));
+  assert(image->height == 0 || VerifyRow(image->height - 1));
+}
+
+void RowDecoder::Decode(int x, int y, int width, uint32_t* values) const {
+  assert(x >= 0 && x + width <= image_->width);
+  assert(y >= 0 && y < image_->height);
+  if (decode_ == nullptr) {
+    DecodeSlow(x, y, width, values);
+    return;
+  }
+  const unsigned char* const row =
+      reinterpret_cast<const unsigned char*>(image_->data) + y * image_->bytes_per_line;
+  decode_(row, x + x_offset_, width, values);
+  if (depth_mask_ != 0xffffffff) {
+    for (int i = 0; i < width; ++i) {
+      values[i] &= depth_mask_;
+    }
+  }
+}
+
+void RowDecoder::DecodeSlow(int x, int y, int width, uint32_t* values) const {
+  for (int i = 0; i < width; ++i) {
+    values[i] = static_cast<uint32_t>(XGetPixel(image_, x + i, y));
+  }
+}
+
+bool RowDecoder::VerifyRow(int y) const {
+  if (decode_ == nullptr) {
+    return true;
+  }
+  std::vector<uint32_t> fast(image_->width);
+  std::vector<uint32_t> slow(image_->width);
+  Decode(0, y, image_->width, fast.data());
+  DecodeSlow(0, y, image_->width, slow.data());
+  return fast == slow;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Pixel values to colours.
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Colour channels, as laid out in the usual 24 bit true colour visuals.
+const unsigned long kRedMask888 = 0xff0000;
+const unsigned long kGreenMask888 = 0x00ff00;
+const unsigned long kBlueMask888 = 0x0000ff;
+const uint32_t kOpaque = 0xff000000;
+
+void PixelMapper::Channel::Init(unsigned long channel_mask) {
+  mask = static_cast<uint32_t>(channel_mask);
+  shift = 0;
+  while (shift < 32 && !(mask & (uint32_t(1) << shift))) {
+    ++shift;
+  }
+  bits = 0;
+  while (shift + bits < 32 && (mask & (uint32_t(1) << (shift + bits)))) {
+    ++bits;
+  }
+  scale.clear();
+  if (bits > 0 && bits <= 8) {
+    const uint32_t max = (uint32_t(1) << bits) - 1;
+    scale.resize(max + 1);
+    for (uint32_t value = 0; value <= max; ++value) {
+      scale[value] = static_cast<uint8_t>((value * 255 + max / 2) / max);
+    }
+  }
+}
+
+uint32_t PixelMapper::Channel::Extract(uint32_t pixel) const {
+  const uint32_t value = (pixel & mask) >> shift;
+  return bits <= 8 ? scale[value] : value >> (bits - 8);
+}
+
+PixelMapper::PixelMapper(const XImage* image, const Visual* visual)
+: kind_(kIndexed), palette_size_(0) {
+  unsigned long red_mask = image->red_mask;
+  unsigned long green_mask = image->green_mask;
+  unsigned long blue_mask = image->blue_mask;
+  if ((red_mask | green_mask | blue_mask) == 0 && visual != nullptr) {
+    // Images of pixmaps carry no visual, hence no channel masks.
+    red_mask = visual->red_mask;
+    green_mask = visual->green_mask;
+    blue_mask = visual->blue_mask;
+  }
+  if (image->depth > 8 && red_mask && green_mask && blue_mask) {
+    if (red_mask == kRedMask888 && green_mask == kGreenMask888 && blue_mask == kBlueMask888) {
+      kind_ = kDirect888;
+    } else {
+      kind_ = kTrueColor;
+    }
+    red_.Init(red_mask);
+    green_.Init(green_mask);
+    blue_.Init(blue_mask);
+  } else {
+    palette_size_ = size_t(1) << std::min(image->depth, 8);
+    palette_.assign(palette_size_, kOpaque);
+  }
+}
+
+void PixelMapper::SetPalette(const std::vector<uint32_t>& palette) {
+  assert(palette.size() == palette_size_);
+  palette_ = palette;
+}
+
+uint32_t PixelMapper::MapPixel(uint32_t pixel) const {
+  switch (kind_) {
+    case kIndexed:
+      // Values beyond the palette only occur for deep images without a usable
+      // visual; they all share the last entry.
+      return palette_[std::min<size_t>(pixel, palette_size_ - 1)];
+    case kDirect888:
+      return kOpaque | (pixel & 0xffffff);
+    case kTrueColor:
+      return kOpaque | (red_.Extract(pixel) << 16) | (green_.Extract(pixel) << 8) |
+          blue_.Extract(pixel);
+  }
+  return kOpaque;
+}
+
+void PixelMapper::Map(const uint32_t* values, size_t count, uint32_t* colours) const {
+  switch (kind_) {
+    case kIndexed:
+      for (size_t i = 0; i < count; ++i) {
+        colours[i] = palette_[std::min<size_t>(values[i], palette_size_ - 1)];
+      }
+      break;
+    case kDirect888:
+      OpaqueRGB(values, count, colours);
+      break;
+    case kTrueColor:
+      for (size_t i = 0; i < count; ++i) {
+        colours[i] = MapPixel(values[i]);
+      }
+      break;
+  }
+}
@@ -0,0 +1,92 @@
+/*
+ *  pixelConverter.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Conversion of XImage content into ARGB pixels, one scanline at a time.
+ *  The image format is inspected once, when the converter is built; rows are
+ *  then handled by loops specialised for the pixel size and byte order.
+ */
+
+#ifndef XKBGROWL_PIXEL_CONVERTER
+#define XKBGROWL_PIXEL_CONVERTER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <X11/Xlib.h>
+
+#include "pixelKernels.h"
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Extracts the raw pixel values of an XImage. Formats without a specialised
+// row decoder go through XGetPixel, one pixel at a time.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class RowDecoder {
+public:
+  explicit RowDecoder(XImage* image);
+  // True if rows are decoded by a specialised loop rather than by XGetPixel.
+  bool specialized() const { return decode_ != nullptr; }
+  // Values of the pixels [x, x + width[ of row y.
+  void Decode(int x, int y, int width, uint32_t* values) const;
+  // Reference implementation of Decode, based on XGetPixel.
+  void DecodeSlow(int x, int y, int width, uint32_t* values) const;
+  typedef void (*DecodeFunction)(const unsigned char* row, int x, int width, uint32_t* values);
+private:
+  // Checks the specialised decoder against XGetPixel on one row.
+  bool VerifyRow(int y) const;
+
+  XImage* const image_;  // not owned
+  DecodeFunction decode_;
+  int x_offset_;         // Added to x, bitmaps can start in the middle of a byte.
+  uint32_t depth_mask_;  // Bits of the value that are part of the pixel.
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Translates pixel values into 0xAARRGGBB colours, either through the channel
+// masks of a true colour visual or through a palette.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class PixelMapper {
+public:
+  // visual provides the channel masks if the image has none, can be null.
+  PixelMapper(const XImage* image, const Visual* visual);
+  // True if the colours come from a palette that must be set by the caller.
+  bool indexed() const { return kind_ == kIndexed; }
+  // True if the low 24 bits of a pixel value already are its RGB colour.
+  bool direct() const { return kind_ == kDirect888; }
+  // Number of palette entries needed for an indexed image.
+  size_t palette_size() const { return palette_size_; }
+  void SetPalette(const std::vector<uint32_t>& palette);
+  uint32_t MapPixel(uint32_t pixel) const;
+  // Maps count values, values and colours can be the same buffer.
+  void Map(const uint32_t* values, size_t count, uint32_t* colours) const;
+private:
+  enum Kind {
+    kIndexed,     // Palette lookup
+    kDirect888,   // 8 bits per channel at the usual place, no conversion
+    kTrueColor    // Any other channel layout
+  };
+  struct Channel {
+    uint32_t mask;
+    int shift;
+    int bits;
+    std::vector<uint8_t> scale;  // Value to 8 bits, for channels of at most 8 bits.
+    void Init(unsigned long channel_mask);
+    uint32_t Extract(uint32_t pixel) const;
+  };
+
+  Kind kind_;
+  size_t palette_size_;
+  std::vector<uint32_t> palette_;
+  Channel red_;
+  Channel green_;
+  Channel blue_;
+};
+
+#endif
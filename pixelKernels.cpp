@@ -0,0 +1,341 @@
+/*
+ *  pixelKernels.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "pixelKernels.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define XKBGROWL_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+const uint32_t kAlphaMask = 0xff000000;
+const uint32_t kRGBMask = 0x00ffffff;
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Portable kernels, also used for the tail of the vector loops.
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Xlib returns format 32 properties as arrays of long, which are 64 bits wide
+// on LP64 systems.
+static void PackCardinalsScalar(const unsigned long* source, size_t count,
+                                uint32_t* destination) {
+  for (size_t i = 0; i < count; ++i) {
+    destination[i] = static_cast<uint32_t>(source[i]);
+  }
+}
+
+static void OpaqueRGBScalar(const uint32_t* values, size_t count, uint32_t* colours) {
+  for (size_t i = 0; i < count; ++i) {
+    colours[i] = kAlphaMask | (values[i] & kRGBMask);
+  }
+}
+
+static void ApplyMaskScalar(const uint32_t* mask, size_t count, uint32_t* colours) {
+  for (size_t i = 0; i < count; ++i) {
+    if (!mask[i]) {
+      colours[i] &= kRGBMask;
+    }
+  }
+}
+
+static void StoreARGBScalar(const uint32_t* colours, size_t count, unsigned char* destination) {
+  for (size_t i = 0; i < count; ++i) {
+    const uint32_t p = colours[i];
+    *destination++ = (p >> 24) & 0xff;
+    *destination++ = (p >> 16) & 0xff;
+    *destination++ = (p >> 8) & 0xff;
+    *destination++ = p & 0xff;
+  }
+}
+
+static const PixelKernelTable kScalarKernels = {
+  "scalar", PackCardinalsScalar, OpaqueRGBScalar, ApplyMaskScalar, StoreARGBScalar
+};
+
+#ifdef XKBGROWL_X86_KERNELS
+
+// ─────────────────────────────────────────────────────────────────────────────
+// SSE2 kernels, four pixels at a time. x86 is little endian, so a 0xAARRGGBB
+// value sits in memory as B, G, R, A and StoreARGB is a byte swap.
+// ─────────────────────────────────────────────────────────────────────────────
+
+__attribute__((target("sse2")))
+static void PackCardinalsSSE2(const unsigned long* source, size_t count,
+                              uint32_t* destination) {
+  size_t i = 0;
+  if (sizeof(unsigned long) == 8) {
+    for (; i + 4 <= count; i += 4) {
+      const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + 2));
+      // Keep the low half of each 64 bit value.
+      const __m128i packed = _mm_unpacklo_epi64(_mm_shuffle_epi32(low, _MM_SHUFFLE(3, 1, 2, 0)),
+                                                _mm_shuffle_epi32(high, _MM_SHUFFLE(3, 1, 2, 0)));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), packed);
+    }
+  }
+  PackCardinalsScalar(source + i, count - i, destination + i);
+}
+
+__attribute__((target("sse2")))
+static void OpaqueRGBSSE2(const uint32_t* values, size_t count, uint32_t* colours) {
+  const __m128i alpha = _mm_set1_epi32(static_cast<int>(kAlphaMask));
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(colours + i), _mm_or_si128(v, alpha));
+  }
+  OpaqueRGBScalar(values + i, count - i, colours + i);
+}
+
+__attribute__((target("sse2")))
+static void ApplyMaskSSE2(const uint32_t* mask, size_t count, uint32_t* colours) {
+  const __m128i alpha = _mm_set1_epi32(static_cast<int>(kAlphaMask));
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i));
+    const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colours + i));
+    // Alpha bits of the pixels whose mask is 0.
+    const __m128i clear = _mm_and_si128(_mm_cmpeq_epi32(m, zero), alpha);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(colours + i), _mm_andnot_si128(clear, c));
+  }
+  ApplyMaskScalar(mask + i, count - i, colours + i);
+}
+
+__attribute__((target("sse2")))
+static void StoreARGBSSE2(const uint32_t* colours, size_t count, unsigned char* destination) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colours + i));
+    // Swap the bytes of each 16 bit word, then the words of each 32 bit value.
+    const __m128i bytes = _mm_or_si128(_mm_slli_epi16(c, 8), _mm_srli_epi16(c, 8));
+    const __m128i swapped = _mm_shufflehi_epi16(_mm_shufflelo_epi16(bytes, _MM_SHUFFLE(2, 3, 0, 1)),
+                                                _MM_SHUFFLE(2, 3, 0, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + 4 * i), swapped);
+  }
+  StoreARGBScalar(colours + i, count - i, destination + 4 * i);
+}
+
+static const PixelKernelTable kSSE2Kernels = {
+  "sse2", PackCardinalsSSE2, OpaqueRGBSSE2, ApplyMaskSSE2, StoreARGBSSE2
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// AVX2 kernels, eight pixels at a time.
+// ─────────────────────────────────────────────────────────────────────────────
+
+__attribute__((target("avx2")))
+static void PackCardinalsAVX2(const unsigned long* source, size_t count,
+                              uint32_t* destination) {
+  size_t i = 0;
+  if (sizeof(unsigned long) == 8) {
+    const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    for (; i + 8 <= count; i += 8) {
+      const __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+      const __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i + 4));
+      const __m256i packed = _mm256_permute2x128_si256(_mm256_permutevar8x32_epi32(low, even),
+                                                       _mm256_permutevar8x32_epi32(high, even),
+                                                       0x20);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), packed);
+    }
+  }
+  PackCardinalsSSE2(source + i, count - i, destination + i);
+}
+
+__attribute__((target("avx2")))
+static void OpaqueRGBAVX2(const uint32_t* values, size_t count, uint32_t* colours) {
+  const __m256i alpha = _mm256_set1_epi32(static_cast<int>(kAlphaMask));
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(colours + i), _mm256_or_si256(v, alpha));
+  }
+  OpaqueRGBSSE2(values + i, count - i, colours + i);
+}
+
+__attribute__((target("avx2")))
+static void ApplyMaskAVX2(const uint32_t* mask, size_t count, uint32_t* colours) {
+  const __m256i alpha = _mm256_set1_epi32(static_cast<int>(kAlphaMask));
+  const __m256i zero = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask + i));
+    const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colours + i));
+    const __m256i clear = _mm256_and_si256(_mm256_cmpeq_epi32(m, zero), alpha);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(colours + i), _mm256_andnot_si256(clear, c));
+  }
+  ApplyMaskSSE2(mask + i, count - i, colours + i);
+}
+
+__attribute__((target("avx2")))
+static void StoreARGBAVX2(const uint32_t* colours, size_t count, unsigned char* destination) {
+  const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colours + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + 4 * i),
+                        _mm256_shuffle_epi8(c, swap));
+  }
+  StoreARGBSSE2(colours + i, count - i, destination + 4 * i);
+}
+
+static const PixelKernelTable kAVX2Kernels = {
+  "avx2", PackCardinalsAVX2, OpaqueRGBAVX2, ApplyMaskAVX2, StoreARGBAVX2
+};
+
+#endif  // XKBGROWL_X86_KERNELS
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Runtime selection
+// ─────────────────────────────────────────────────────────────────────────────
+
+static const PixelKernelTable* SelectKernels() {
+#ifdef XKBGROWL_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return &kAVX2Kernels;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return &kSSE2Kernels;
+  }
+#endif
+  return &kScalarKernels;
+}
+
+static const PixelKernelTable& Kernels() {
+  static const PixelKernelTable* const kernels = SelectKernels();
+  return *kernels;
+}
+
+void PackCardinals(const unsigned long* source, size_t count, uint32_t* destination) {
+  Kernels().pack_cardinals(source, count, destination);
+}
+
+void OpaqueRGB(const uint32_t* values, size_t count, uint32_t* colours) {
+  Kernels().opaque_rgb(values, count, colours);
+}
+
+void ApplyMask(const uint32_t* mask, size_t count, uint32_t* colours) {
+  Kernels().apply_mask(mask, count, colours);
+}
+
+void StoreARGB(const uint32_t* colours, size_t count, unsigned char* destination) {
+  Kernels().store_argb(colours, count, destination);
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Bitmap masks, eight pixels per byte. Icon masks are mostly runs of fully
+// opaque or fully transparent bytes, which need no bit twiddling.
+// ─────────────────────────────────────────────────────────────────────────────
+
+static inline bool MaskBit(unsigned char byte, int bit, bool msb_first) {
+  return msb_first ? (byte >> (7 - bit)) & 1 : (byte >> bit) & 1;
+}
+
+void ApplyBitmapMask(const unsigned char* bits, int first_bit, bool msb_first, size_t count,
+                     uint32_t* colours) {
+  bits += first_bit >> 3;
+  int bit = first_bit & 7;
+  size_t i = 0;
+  // Leading bits, up to the first byte boundary.
+  for (; bit != 0 && i < count; ++i) {
+    if (!MaskBit(*bits, bit, msb_first)) {
+      colours[i] &= kRGBMask;
+    }
+    if (++bit == 8) {
+      bit = 0;
+      ++bits;
+    }
+  }
+  for (; i + 8 <= count; i += 8, ++bits) {
+    const unsigned char byte = *bits;
+    if (byte == 0xff) {
+      continue;
+    }
+    if (byte == 0) {
+      for (int b = 0; b < 8; ++b) {
+        colours[i + b] &= kRGBMask;
+      }
+      continue;
+    }
+    for (int b = 0; b < 8; ++b) {
+      if (!MaskBit(byte, b, msb_first)) {
+        colours[i + b] &= kRGBMask;
+      }
+    }
+  }
+  for (int b = 0; i < count; ++i, ++b) {
+    if (!MaskBit(*bits, b, msb_first)) {
+      colours[i] &= kRGBMask;
+    }
+  }
+}
+
+// Reverses the byte order of count 32 bit pixels, BGRA to ARGB.
+static void SwapPixels(const unsigned char* source, size_t count, unsigned char* destination) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  // A B, G, R, A pixel is a 0xAARRGGBB value on little endian hosts.
+  StoreARGB(reinterpret_cast<const uint32_t*>(source), count, destination);
+#else
+  for (size_t i = 0; i < count; ++i, source += 4, destination += 4) {
+    destination[0] = source[3];
+    destination[1] = source[2];
+    destination[2] = source[1];
+    destination[3] = source[0];
+  }
+#endif
+}
+
+static void ForceOpaque(size_t count, unsigned char* argb) {
+  for (size_t i = 0; i < count; ++i) {
+    argb[4 * i] = 0xff;
+  }
+}
+
+void ConvertToARGB(const unsigned char* source, PixelFormat format, size_t count,
+                   unsigned char* destination) {
+  switch (format) {
+    case kPixelFormatARGB:
+      memcpy(destination, source, count * 4);
+      break;
+    case kPixelFormatXRGB:
+      memcpy(destination, source, count * 4);
+      ForceOpaque(count, destination);
+      break;
+    case kPixelFormatBGRA:
+      SwapPixels(source, count, destination);
+      break;
+    case kPixelFormatBGRX:
+      SwapPixels(source, count, destination);
+      ForceOpaque(count, destination);
+      break;
+  }
+}
+
+const char* PixelKernelsName() {
+  return Kernels().name;
+}
+
+size_t SupportedPixelKernelTables(const PixelKernelTable* tables[kMaxPixelKernelTables]) {
+  size_t count = 0;
+  tables[count++] = &kScalarKernels;
+#ifdef XKBGROWL_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    tables[count++] = &kSSE2Kernels;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    tables[count++] = &kAVX2Kernels;
+  }
+#endif
+  return count;
+}
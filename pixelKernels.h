@@ -0,0 +1,62 @@
+/*
+ *  pixelKernels.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Inner loops that touch every icon pixel. Each kernel has a portable
+ *  implementation and, on x86, SSE2 and AVX2 versions; the best version
+ *  supported by the processor is picked the first time a kernel is used.
+ */
+
+#ifndef XKBGROWL_PIXEL_KERNELS
+#define XKBGROWL_PIXEL_KERNELS
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "x11Util.h"
+
+// Copies 32 bit property values, returned by Xlib as longs, into packed pixels.
+void PackCardinals(const unsigned long* source, size_t count, uint32_t* destination);
+
+// Turns 0x??RRGGBB values into opaque 0xffRRGGBB colours.
+void OpaqueRGB(const uint32_t* values, size_t count, uint32_t* colours);
+
+// Forces the alpha of the colours whose mask value is 0 to transparent.
+void ApplyMask(const uint32_t* mask, size_t count, uint32_t* colours);
+
+// Same as ApplyMask for a mask given as a row of bits, starting at bit
+// first_bit of bits, most significant bit first if msb_first.
+void ApplyBitmapMask(const unsigned char* bits, int first_bit, bool msb_first, size_t count,
+                     uint32_t* colours);
+
+// Writes 0xAARRGGBB values as A, R, G, B bytes.
+void StoreARGB(const uint32_t* colours, size_t count, unsigned char* destination);
+
+// Converts count pixels in format into A, R, G, B bytes.
+void ConvertToARGB(const unsigned char* source, PixelFormat format, size_t count,
+                   unsigned char* destination);
+
+// Name of the instruction set used by the kernels: "scalar", "sse2" or "avx2".
+const char* PixelKernelsName();
+
+// Kernels for one instruction set.
+struct PixelKernelTable {
+  const char* name;
+  void (*pack_cardinals)(const unsigned long* source, size_t count, uint32_t* destination);
+  void (*opaque_rgb)(const uint32_t* values, size_t count, uint32_t* colours);
+  void (*apply_mask)(const uint32_t* mask, size_t count, uint32_t* colours);
+  void (*store_argb)(const uint32_t* colours, size_t count, unsigned char* destination);
+};
+const size_t kMaxPixelKernelTables = 3;
+
+// Sets tables to the kernels of every instruction set the processor supports,
+// the scalar reference first, and returns how many there are. Lets the
+// kernels be checked against each other, see pixelKernelsTest.cpp.
+size_t SupportedPixelKernelTables(const PixelKernelTable* tables[kMaxPixelKernelTables]);
+
+#endif
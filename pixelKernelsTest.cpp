@@ -0,0 +1,299 @@
+/*
+ *  pixelKernelsTest.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Standalone check and benchmark of the pixel kernels: every kernel the
+ *  processor supports is compared with the portable one, then timed.
+ *
+ *    c++ -std=c++14 -O2 pixelKernelsTest.cpp pixelKernels.cpp -o pixelKernelsTest
+ *    ./pixelKernelsTest [-check]
+ *
+ *  Exits with a non zero status if a kernel disagrees with the portable one.
+ *  With -check, the benchmark is skipped: the xkbgrowl target runs it that way
+ *  in its "Check pixel kernels" build phase, so a failing check fails the build.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "pixelKernels.h"
+
+// Widths up to this cover every remainder modulo 8 and 16 a few times over.
+const size_t kMaxSmallWidth = 40;
+// Wider rows, around the size of a large icon.
+const size_t kLargeWidths[] = { 999, 1000, 1001, 1007, 1024, 1031 };
+// Element offsets of the first pixel, so that vector loads are unaligned.
+const size_t kMaxOffset = 7;
+// Guard values written after the last pixel, kernels must not touch them.
+const size_t kGuard = 16;
+const unsigned char kGuardByte = 0xa5;
+// Benchmark: a 128 × 128 icon, converted this many times per kernel.
+const size_t kBenchmarkPixels = 128 * 128;
+const int kBenchmarkRounds = 2000;
+
+const char kMismatchFormat[] = "FAIL %s %s: width %zu, offset %zu\n";
+const char kBitmapMismatchFormat[] =
+    "FAIL ApplyBitmapMask: byte 0x%02x, first bit %d, %s, count %zu\n";
+const char kBenchmarkFormat[] = "%-8s %-14s %8.1f Mpixel/s\n";
+
+static int failures = 0;
+
+static uint32_t Random32() {
+  static uint64_t state = 0x9e3779b97f4a7c15ULL;
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return static_cast<uint32_t>(state >> 16);
+}
+
+// Buffer of count elements starting offset elements past an aligned start,
+// followed by guard bytes.
+template <typename T>
+class TestBuffer {
+public:
+  TestBuffer(size_t count, size_t offset) : count_(count), offset_(offset),
+      storage_((offset + count + kGuard) * sizeof(T) + 64, kGuardByte) {}
+  T* data() {
+    unsigned char* aligned = storage_.data();
+    aligned += (64 - reinterpret_cast<uintptr_t>(aligned) % 64) % 64;
+    return reinterpret_cast<T*>(aligned) + offset_;
+  }
+  bool GuardIntact() {
+    const unsigned char* guard = reinterpret_cast<const unsigned char*>(data() + count_);
+    for (size_t i = 0; i < kGuard * sizeof(T); ++i) {
+      if (guard[i] != kGuardByte) {
+        return false;
+      }
+    }
+    return true;
+  }
+private:
+  const size_t count_;
+  const size_t offset_;
+  std::vector<unsigned char> storage_;
+};
+
+static void Check(bool ok, const PixelKernelTable& table, const char* kernel, size_t width,
+                  size_t offset) {
+  if (!ok) {
+    fprintf(stderr, kMismatchFormat, table.name, kernel, width, offset);
+    ++failures;
+  }
+}
+
+// Mask values that are zero or not in each lane, following the bits of
+// pattern, so that every combination of eight lanes is seen.
+static uint32_t MaskValue(unsigned pattern, size_t i) {
+  if (!((pattern >> (i % 8)) & 1)) {
+    return 0;
+  }
+  // Non zero values that only have a single high or low bit set too.
+  switch (Random32() % 4) {
+    case 0: return 0x80000000;
+    case 1: return 1;
+    default: return Random32() | 1;
+  }
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Kernels of one instruction set against the portable ones.
+// ─────────────────────────────────────────────────────────────────────────────
+
+static void CheckWidth(const PixelKernelTable& scalar, const PixelKernelTable& table,
+                       size_t width, size_t offset) {
+  // Property values with garbage in the high bits of 64 bit longs.
+  TestBuffer<unsigned long> cardinals(width, offset);
+  for (size_t i = 0; i < width; ++i) {
+    cardinals.data()[i] = static_cast<unsigned long>(Random32()) |
+        (sizeof(unsigned long) > 4 ? static_cast<unsigned long>(~0ULL << 32) : 0);
+  }
+  TestBuffer<uint32_t> expected(width, 0);
+  TestBuffer<uint32_t> actual(width, offset);
+  scalar.pack_cardinals(cardinals.data(), width, expected.data());
+  table.pack_cardinals(cardinals.data(), width, actual.data());
+  Check(memcmp(expected.data(), actual.data(), width * 4) == 0 && actual.GuardIntact(), table,
+        "PackCardinals", width, offset);
+
+  TestBuffer<uint32_t> values(width, offset);
+  for (size_t i = 0; i < width; ++i) {
+    values.data()[i] = Random32();
+  }
+  scalar.opaque_rgb(values.data(), width, expected.data());
+  table.opaque_rgb(values.data(), width, actual.data());
+  Check(memcmp(expected.data(), actual.data(), width * 4) == 0 && actual.GuardIntact(), table,
+        "OpaqueRGB", width, offset);
+
+  for (unsigned pattern = 0; pattern < 256; ++pattern) {
+    TestBuffer<uint32_t> mask(width, kMaxOffset - offset);
+    for (size_t i = 0; i < width; ++i) {
+      mask.data()[i] = MaskValue(pattern, i);
+      expected.data()[i] = actual.data()[i] = Random32();
+    }
+    scalar.apply_mask(mask.data(), width, expected.data());
+    table.apply_mask(mask.data(), width, actual.data());
+    if (memcmp(expected.data(), actual.data(), width * 4) != 0 || !actual.GuardIntact()) {
+      Check(false, table, "ApplyMask", width, offset);
+      break;
+    }
+  }
+
+  // Destinations are also misaligned by single bytes.
+  for (size_t shift = 0; shift < 4; ++shift) {
+    TestBuffer<unsigned char> expected_bytes(width * 4, 0);
+    TestBuffer<unsigned char> actual_bytes(width * 4, offset * 4 + shift);
+    scalar.store_argb(values.data(), width, expected_bytes.data());
+    table.store_argb(values.data(), width, actual_bytes.data());
+    Check(memcmp(expected_bytes.data(), actual_bytes.data(), width * 4) == 0 &&
+          actual_bytes.GuardIntact(), table, "StoreARGB", width, offset * 4 + shift);
+  }
+}
+
+static void CheckTable(const PixelKernelTable& scalar, const PixelKernelTable& table) {
+  for (size_t offset = 0; offset <= kMaxOffset; ++offset) {
+    for (size_t width = 0; width <= kMaxSmallWidth; ++width) {
+      CheckWidth(scalar, table, width, offset);
+    }
+    for (size_t i = 0; i < sizeof(kLargeWidths) / sizeof(kLargeWidths[0]); ++i) {
+      CheckWidth(scalar, table, kLargeWidths[i], offset);
+    }
+  }
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Bitmap masks against a bit by bit reading of the mask.
+// ─────────────────────────────────────────────────────────────────────────────
+
+static void CheckBitmapMask() {
+  // A run of identical bytes, so the whole byte path and the partial ones
+  // both see every pattern.
+  const size_t kBytes = 6;
+  for (int byte = 0; byte < 256; ++byte) {
+    unsigned char bits[kBytes];
+    memset(bits, byte, sizeof(bits));
+    for (int first_bit = 0; first_bit < 8; ++first_bit) {
+      for (int msb_first = 0; msb_first < 2; ++msb_first) {
+        for (size_t count = 0; count + first_bit <= kBytes * 8; ++count) {
+          std::vector<uint32_t> expected(count);
+          for (size_t i = 0; i < count; ++i) {
+            expected[i] = Random32();
+          }
+          std::vector<uint32_t> actual(expected);
+          for (size_t i = 0; i < count; ++i) {
+            const size_t bit = first_bit + i;
+            const int shift = msb_first ? 7 - bit % 8 : bit % 8;
+            if (!((bits[bit / 8] >> shift) & 1)) {
+              expected[i] &= 0x00ffffff;
+            }
+          }
+          ApplyBitmapMask(bits, first_bit, msb_first, count, actual.data());
+          if (expected != actual) {
+            fprintf(stderr, kBitmapMismatchFormat, byte, first_bit,
+                    msb_first ? "msb first" : "lsb first", count);
+            ++failures;
+          }
+        }
+      }
+    }
+  }
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Conversions of each pixel format, which go through StoreARGB.
+// ─────────────────────────────────────────────────────────────────────────────
+
+static void CheckConvert() {
+  const size_t kPixels = 37;
+  unsigned char source[kPixels * 4];
+  for (size_t i = 0; i < sizeof(source); ++i) {
+    source[i] = static_cast<unsigned char>(Random32());
+  }
+  const PixelFormat formats[] = {
+    kPixelFormatARGB, kPixelFormatBGRA, kPixelFormatXRGB, kPixelFormatBGRX
+  };
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+    unsigned char actual[kPixels * 4];
+    ConvertToARGB(source, formats[f], kPixels, actual);
+    const bool swapped = formats[f] == kPixelFormatBGRA || formats[f] == kPixelFormatBGRX;
+    const bool opaque = formats[f] == kPixelFormatXRGB || formats[f] == kPixelFormatBGRX;
+    for (size_t i = 0; i < kPixels * 4; ++i) {
+      unsigned char expected = swapped ? source[i - i % 4 + 3 - i % 4] : source[i];
+      if (opaque && i % 4 == 0) {
+        expected = 0xff;
+      }
+      if (actual[i] != expected) {
+        fprintf(stderr, kMismatchFormat, PixelKernelsName(), "ConvertToARGB", kPixels, f);
+        ++failures;
+        break;
+      }
+    }
+  }
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Benchmark
+// ─────────────────────────────────────────────────────────────────────────────
+
+template <typename Kernel>
+static void Time(const PixelKernelTable& table, const char* kernel, Kernel run) {
+  typedef std::chrono::steady_clock Clock;
+  run();  // Warm up the caches.
+  const Clock::time_point start = Clock::now();
+  for (int round = 0; round < kBenchmarkRounds; ++round) {
+    run();
+  }
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  printf(kBenchmarkFormat, table.name, kernel,
+         kBenchmarkPixels * static_cast<double>(kBenchmarkRounds) / seconds / 1e6);
+}
+
+static void Benchmark(const PixelKernelTable& table) {
+  std::vector<unsigned long> cardinals(kBenchmarkPixels);
+  std::vector<uint32_t> values(kBenchmarkPixels);
+  std::vector<uint32_t> mask(kBenchmarkPixels);
+  std::vector<uint32_t> colours(kBenchmarkPixels);
+  std::vector<unsigned char> bytes(kBenchmarkPixels * 4);
+  for (size_t i = 0; i < kBenchmarkPixels; ++i) {
+    cardinals[i] = values[i] = Random32();
+    mask[i] = Random32() % 4 ? 1 : 0;
+  }
+  Time(table, "PackCardinals", [&]() {
+    table.pack_cardinals(cardinals.data(), kBenchmarkPixels, colours.data());
+  });
+  Time(table, "OpaqueRGB", [&]() {
+    table.opaque_rgb(values.data(), kBenchmarkPixels, colours.data());
+  });
+  Time(table, "ApplyMask", [&]() {
+    table.apply_mask(mask.data(), kBenchmarkPixels, colours.data());
+  });
+  Time(table, "StoreARGB", [&]() {
+    table.store_argb(values.data(), kBenchmarkPixels, bytes.data());
+  });
+}
+
+int main(int argc, char** argv) {
+  const bool check_only = argc > 1 && strcmp(argv[1], "-check") == 0;
+  const PixelKernelTable* tables[kMaxPixelKernelTables];
+  const size_t count = SupportedPixelKernelTables(tables);
+  for (size_t i = 1; i < count; ++i) {
+    CheckTable(*tables[0], *tables[i]);
+  }
+  CheckBitmapMask();
+  CheckConvert();
+  if (failures > 0) {
+    fprintf(stderr, "%d failures\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("Checked %zu kernel sets, using %s\n", count, PixelKernelsName());
+  for (size_t i = 0; i < count && !check_only; ++i) {
+    Benchmark(*tables[i]);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,206 @@
+/*
+ *  rateLimiter.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "rateLimiter.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+const char kLimiterStatisticsFormat[] = "Rate limiter: %zu bells suppressed, %zu digests\n";
+const char kDigestName[] = "Rate limit";
+// Number of keys named in a digest, the others are only counted.
+const size_t kDigestKeys = 3;
+
+bool ParseRateLimit(const std::string& text, RateLimit* limit) {
+  char* end = nullptr;
+  const double rate = strtod(text.c_str(), &end);
+  if (end == text.c_str() || rate < 0) {
+    return false;
+  }
+  double burst = std::max(rate, 1.0);
+  if (*end == ':') {
+    const char* const start = end + 1;
+    burst = strtod(start, &end);
+    if (end == start || burst < 1) {
+      return false;
+    }
+  }
+  if (*end != '\0') {
+    return false;
+  }
+  limit->rate = rate;
+  limit->burst = burst;
+  return true;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Token bucket
+// ─────────────────────────────────────────────────────────────────────────────
+
+TokenBucket::TokenBucket(const RateLimit& limit, Clock::time_point now)
+: tokens_(limit.burst), last_(now) {}
+
+void TokenBucket::Refill(const RateLimit& limit, Clock::time_point now) {
+  if (now <= last_) {
+    return;
+  }
+  const double elapsed = std::chrono::duration<double>(now - last_).count();
+  tokens_ = std::min(limit.burst, tokens_ + elapsed * limit.rate);
+  last_ = now;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Digest of the suppressed bells, posted as a bell of its own.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class DigestEvent : public BellEvent {
+public:
+  explicit DigestEvent(const std::string& name) : name_(name) {}
+  std::string name() const { return name_; }
+  std::string windowName() const { return kDigestName; }
+  std::string hostName() const { return std::string(); }
+  std::string displayName() const { return std::string(); }
+  unsigned long window() const { return 0; }
+  int pitch() const { return 0; }
+  int percent() const { return 0; }
+  int duration() const { return 0; }
+  int bellClass() const { return 0; }
+  int bellId() const { return 0; }
+  bool eventOnly() const { return true; }
+  const ImageProxy* imageProxy() const { return nullptr; }
+private:
+  const std::string name_;
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Limiter
+// ─────────────────────────────────────────────────────────────────────────────
+
+BellRateLimiter::BellRateLimiter(const RateLimit& window_limit, const RateLimit& name_limit,
+                                 const RateLimit& host_limit, int digest_interval)
+: window_limit_(window_limit), name_limit_(name_limit), host_limit_(host_limit),
+  digest_interval_(digest_interval), last_digest_(Clock::now()), suppressed_(0), digests_(0) {}
+
+bool BellRateLimiter::enabled() const {
+  return window_limit_.rate > 0 || name_limit_.rate > 0 || host_limit_.rate > 0;
+}
+
+TokenBucket* BellRateLimiter::Bucket(const RateLimit& limit, const std::string& key,
+                                     Clock::time_point now, BucketMap* buckets) {
+  if (limit.rate <= 0) {
+    return nullptr;
+  }
+  BucketMap::iterator found = buckets->find(key);
+  if (found == buckets->end()) {
+    return &buckets->insert(std::make_pair(key, TokenBucket(limit, now))).first->second;
+  }
+  found->second.Refill(limit, now);
+  return &found->second;
+}
+
+void BellRateLimiter::Prune(const RateLimit& limit, Clock::time_point now, BucketMap* buckets) {
+  for (BucketMap::iterator it = buckets->begin(); it != buckets->end();) {
+    it->second.Refill(limit, now);
+    if (it->second.Idle(limit)) {
+      it = buckets->erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void BellRateLimiter::Suppress(const std::string& what) {
+  ++pending_[what];
+  ++suppressed_;
+}
+
+bool BellRateLimiter::AdmitBell(const std::string& display, unsigned long window,
+                                const std::string& name, Clock::time_point now) {
+  // Fields are separated by a character that cannot appear in any of them.
+  const std::string window_key = display + '\0' + std::to_string(window);
+  TokenBucket* const window_bucket = Bucket(window_limit_, window_key, now, &windows_);
+  TokenBucket* const name_bucket = Bucket(name_limit_, name, now, &names_);
+  // A token is only taken when the bell passes both limits.
+  if (window_bucket != nullptr && !window_bucket->HasToken()) {
+    char what[64];
+    snprintf(what, sizeof(what), "window 0x%lx", window);
+    Suppress(std::string(what) + " on " + display);
+    return false;
+  }
+  if (name_bucket != nullptr && !name_bucket->HasToken()) {
+    Suppress(name.empty() ? "unnamed bell" : "bell " + name);
+    return false;
+  }
+  if (window_bucket != nullptr) {
+    window_bucket->Take();
+  }
+  if (name_bucket != nullptr) {
+    name_bucket->Take();
+  }
+  return true;
+}
+
+bool BellRateLimiter::AdmitHost(const BellEvent& event, Clock::time_point now) {
+  const std::string host = event.hostName();
+  TokenBucket* const bucket = Bucket(host_limit_, host, now, &hosts_);
+  if (bucket == nullptr) {
+    return true;
+  }
+  if (!bucket->HasToken()) {
+    Suppress(host.empty() ? "unknown host" : "host " + host);
+    return false;
+  }
+  bucket->Take();
+  return true;
+}
+
+static bool MoreSuppressed(const std::pair<std::string, size_t>& a,
+                           const std::pair<std::string, size_t>& b) {
+  return a.second > b.second;
+}
+
+BellEvent* BellRateLimiter::Digest(Clock::time_point now) {
+  if (now - last_digest_ < digest_interval_) {
+    return nullptr;
+  }
+  last_digest_ = now;
+  // Buckets are only dropped here, so the maps stay small without a scan per bell.
+  Prune(window_limit_, now, &windows_);
+  Prune(name_limit_, now, &names_);
+  Prune(host_limit_, now, &hosts_);
+  if (pending_.empty()) {
+    return nullptr;
+  }
+  std::vector<std::pair<std::string, size_t> > keys(pending_.begin(), pending_.end());
+  pending_.clear();
+  std::sort(keys.begin(), keys.end(), MoreSuppressed);
+  size_t total = 0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    total += keys[i].second;
+  }
+  std::string text = std::to_string(total) + (total > 1 ? " bells" : " bell") + " suppressed: ";
+  for (size_t i = 0; i < keys.size() && i < kDigestKeys; ++i) {
+    if (i > 0) {
+      text += ", ";
+    }
+    text += keys[i].first + " (" + std::to_string(keys[i].second) + ")";
+  }
+  if (keys.size() > kDigestKeys) {
+    text += ", …";
+  }
+  ++digests_;
+  return new DigestEvent(text);
+}
+
+void BellRateLimiter::PrintStatistics(FILE* file) const {
+  fprintf(file, kLimiterStatisticsFormat, suppressed_.load(std::memory_order_relaxed),
+          digests_.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,109 @@
+/*
+ *  rateLimiter.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_RATE_LIMITER
+#define XKBGROWL_RATE_LIMITER
+#include <atomic>
+#include <chrono>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+
+#include "x11Util.h"
+
+// Sustained rate, in bells per second, and burst size of a token bucket.
+// A rate of 0 disables the limit.
+struct RateLimit {
+  double rate;
+  double burst;
+};
+
+// Parses RATE or RATE:BURST, the burst defaults to the rate, at least 1.
+bool ParseRateLimit(const std::string& text, RateLimit* limit);
+
+// Default interval, in milliseconds, between digests of suppressed bells.
+const int kDefaultDigestInterval = 10000;
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Token bucket: holds up to burst tokens, refilled at rate tokens per second.
+// Each admitted bell takes one token.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class TokenBucket {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  TokenBucket(const RateLimit& limit, Clock::time_point now);
+  // Adds the tokens earned since the last refill.
+  void Refill(const RateLimit& limit, Clock::time_point now);
+  bool HasToken() const { return tokens_ >= 1.0; }
+  void Take() { tokens_ -= 1.0; }
+  // The bucket is full, it behaves as a new one.
+  bool Idle(const RateLimit& limit) const { return tokens_ >= limit.burst; }
+private:
+  double tokens_;
+  Clock::time_point last_;
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Limits the rate of bells per window, per bell name and per host, so that a
+// single client cannot flood the notifications. Window and name are known as
+// soon as the bell is read, so those limits are applied before the window
+// attributes are fetched; the host is one of these attributes, its limit is
+// applied once the bell is resolved, before the icon is converted.
+// Suppressed bells are counted by key and reported in a periodic digest.
+// Only used by the reader thread, but statistics can be read from any thread.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class BellRateLimiter {
+public:
+  typedef TokenBucket::Clock Clock;
+
+  BellRateLimiter(const RateLimit& window_limit, const RateLimit& name_limit,
+                  const RateLimit& host_limit, int digest_interval);
+  bool enabled() const;
+  // Checks the window and name limits of a bell that is not resolved yet.
+  bool AdmitBell(const std::string& display, unsigned long window, const std::string& name,
+                 Clock::time_point now);
+  // Checks the host limit of a resolved bell.
+  bool AdmitHost(const BellEvent& event, Clock::time_point now);
+  // Event summarising the bells suppressed since the last digest, null if
+  // there are none or the digest interval has not elapsed. Caller owns it.
+  BellEvent* Digest(Clock::time_point now);
+
+  size_t suppressed() const { return suppressed_.load(std::memory_order_relaxed); }
+  void PrintStatistics(FILE* file) const;
+private:
+  BellRateLimiter(const BellRateLimiter&);
+  BellRateLimiter& operator=(const BellRateLimiter&);
+  typedef std::unordered_map<std::string, TokenBucket> BucketMap;
+  // Refilled bucket for key, created full if needed. Null if limit is disabled.
+  static TokenBucket* Bucket(const RateLimit& limit, const std::string& key,
+                             Clock::time_point now, BucketMap* buckets);
+  // Forgets the buckets that are full again.
+  static void Prune(const RateLimit& limit, Clock::time_point now, BucketMap* buckets);
+  void Suppress(const std::string& what);
+
+  const RateLimit window_limit_;
+  const RateLimit name_limit_;
+  const RateLimit host_limit_;
+  const std::chrono::milliseconds digest_interval_;
+  BucketMap windows_;
+  BucketMap names_;
+  BucketMap hosts_;
+  // Bells suppressed since the last digest, by description of the key.
+  std::unordered_map<std::string, size_t> pending_;
+  Clock::time_point last_digest_;
+  std::atomic<size_t> suppressed_;  // Since start.
+  std::atomic<size_t> digests_;
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ *  renderScaler.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "renderScaler.h"
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <X11/Xutil.h>
+
+#include "iconResampler.h"
+#include "pixelConverter.h"
+
+const char kRenderScaleError[] = "XRender could not scale drawable %lx\n";
+// Largest side of the averaging kernel, larger reductions get some aliasing.
+const int kMaxKernelSize = 15;
+
+// Set by CatchRenderError while an icon is being scaled.
+static bool renderFailed = false;
+
+static int CatchRenderError(Display* /*display*/, XErrorEvent* /*error*/) {
+  renderFailed = true;
+  return 0;
+}
+
+RenderScaler* RenderScaler::Create(Display* display) {
+  int event_base = 0;
+  int error_base = 0;
+  if (!XRenderQueryExtension(display, &event_base, &error_base)) {
+    return nullptr;
+  }
+  XRenderPictFormat* const format =
+      XRenderFindVisualFormat(display, DefaultVisual(display, DefaultScreen(display)));
+  XRenderPictFormat* const mask_format = XRenderFindStandardFormat(display, PictStandardA1);
+  XRenderPictFormat* const argb_format = XRenderFindStandardFormat(display, PictStandardARGB32);
+  if (format == nullptr || mask_format == nullptr || argb_format == nullptr) {
+    return nullptr;
+  }
+  return new RenderScaler(display, format, mask_format, argb_format);
+}
+
+RenderScaler::RenderScaler(Display* display, XRenderPictFormat* format,
+                           XRenderPictFormat* mask_format, XRenderPictFormat* argb_format)
+: display_(display), format_(format), mask_format_(mask_format), argb_format_(argb_format) {}
+
+bool RenderScaler::Applies(unsigned int width, unsigned int height, unsigned int depth,
+                           int size) const {
+  const unsigned int limit = static_cast<unsigned int>(size);
+  return depth == static_cast<unsigned int>(DefaultDepth(display_, DefaultScreen(display_))) &&
+      (width > limit || height > limit);
+}
+
+// Smallest odd kernel that covers scale source pixels.
+static int KernelSize(double scale) {
+  const int size = static_cast<int>(ceil(scale)) | 1;
+  return std::min(size, kMaxKernelSize);
+}
+
+void RenderScaler::SetScaling(Picture picture, double x_scale, double y_scale) {
+  XTransform transform = { {
+    { XDoubleToFixed(x_scale), 0, 0 },
+    { 0, XDoubleToFixed(y_scale), 0 },
+    { 0, 0, XDoubleToFixed(1.0) }
+  } };
+  XRenderSetPictureTransform(display_, picture, &transform);
+  const int kernel_width = KernelSize(x_scale);
+  const int kernel_height = KernelSize(y_scale);
+  if (kernel_width == 1 && kernel_height == 1) {
+    XRenderSetPictureFilter(display_, picture, FilterBilinear, nullptr, 0);
+    return;
+  }
+  // A box filter: the kernel size, then equal weights.
+  const int count = kernel_width * kernel_height;
+  std::vector<XFixed> parameters(2 + count, XDoubleToFixed(1.0 / count));
+  parameters[0] = XDoubleToFixed(kernel_width);
+  parameters[1] = XDoubleToFixed(kernel_height);
+  XRenderSetPictureFilter(display_, picture, FilterConvolution, parameters.data(),
+                          static_cast<int>(parameters.size()));
+}
+
+// Premultiplied 0xAARRGGBB, as produced by XRender, to straight alpha.
+static uint32_t Unpremultiply(uint32_t pixel) {
+  const uint32_t alpha = pixel >> 24;
+  if (alpha == 0) {
+    return 0;
+  }
+  if (alpha == 0xff) {
+    return pixel;
+  }
+  uint32_t result = alpha << 24;
+  for (int shift = 16; shift >= 0; shift -= 8) {
+    const uint32_t channel = (pixel >> shift) & 0xff;
+    result |= std::min<uint32_t>(0xff, (channel * 0xff + alpha / 2) / alpha) << shift;
+  }
+  return result;
+}
+
+bool RenderScaler::Scale(Drawable drawable, Drawable mask, unsigned int width,
+                         unsigned int height, unsigned int depth, int size,
+                         std::vector<uint32_t>* pixels, int* scaled_width, int* scaled_height) {
+  if (!Applies(width, height, depth, size)) {
+    return false;
+  }
+  int target_width = 0;
+  int target_height = 0;
+  FitIconSize(width, height, size, &target_width, &target_height);
+  // Errors are reported before the reply of XGetImage, the handler catches
+  // those of the requests below.
+  renderFailed = false;
+  int (*const previous)(Display*, XErrorEvent*) = XSetErrorHandler(CatchRenderError);
+  const Pixmap target = XCreatePixmap(display_, DefaultRootWindow(display_), target_width,
+                                      target_height, 32);
+  const Picture source_picture = XRenderCreatePicture(display_, drawable, format_, 0, nullptr);
+  SetScaling(source_picture, double(width) / target_width, double(height) / target_height);
+  Picture mask_picture = None;
+  if (mask != None) {
+    mask_picture = XRenderCreatePicture(display_, mask, mask_format_, 0, nullptr);
+    SetScaling(mask_picture, double(width) / target_width, double(height) / target_height);
+  }
+  const Picture target_picture = XRenderCreatePicture(display_, target, argb_format_, 0, nullptr);
+  XRenderComposite(display_, PictOpSrc, source_picture, mask_picture, target_picture,
+                   0, 0, 0, 0, 0, 0, target_width, target_height);
+  XImage* const image = XGetImage(display_, target, 0, 0, target_width, target_height,
+                                  AllPlanes, ZPixmap);
+  XRenderFreePicture(display_, target_picture);
+  if (mask_picture != None) {
+    XRenderFreePicture(display_, mask_picture);
+  }
+  XRenderFreePicture(display_, source_picture);
+  XFreePixmap(display_, target);
+  XSetErrorHandler(previous);
+  if (renderFailed || image == nullptr) {
+    fprintf(stderr, kRenderScaleError, drawable);
+    if (image != nullptr) {
+      XDestroyImage(image);
+    }
+    return false;
+  }
+  pixels->resize(size_t(target_width) * target_height);
+  const RowDecoder decoder(image);
+  for (int y = 0; y < target_height; ++y) {
+    uint32_t* const row = &(*pixels)[size_t(y) * target_width];
+    decoder.Decode(0, y, target_width, row);
+    for (int x = 0; x < target_width; ++x) {
+      row[x] = Unpremultiply(row[x]);
+    }
+  }
+  XDestroyImage(image);
+  *scaled_width = target_width;
+  *scaled_height = target_height;
+  return true;
+}
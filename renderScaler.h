@@ -0,0 +1,53 @@
+/*
+ *  renderScaler.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_RENDER_SCALER
+#define XKBGROWL_RENDER_SCALER
+
+#include <stdint.h>
+#include <vector>
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrender.h>
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Shrinks icons on the server with XRender, so that only the scaled image
+// crosses the wire. The drawable and its mask are composited into an ARGB32
+// picture of the notification icon size, which is then read back. Only worth
+// it on remote displays, where large icons take long to transfer.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class RenderScaler {
+public:
+  // Returns null if the server does not support XRender.
+  static RenderScaler* Create(Display* display);
+  // True if a width × height drawable of depth is larger than size and can
+  // be scaled by the server.
+  bool Applies(unsigned int width, unsigned int height, unsigned int depth, int size) const;
+  // Scales drawable, masked by the depth 1 mask if it is not None, to fit in
+  // a size × size square. The result is written as non premultiplied
+  // 0xAARRGGBB pixels. Returns false if the server could not do it, the
+  // caller should then fetch the drawable itself.
+  bool Scale(Drawable drawable, Drawable mask, unsigned int width, unsigned int height,
+             unsigned int depth, int size, std::vector<uint32_t>* pixels,
+             int* scaled_width, int* scaled_height);
+private:
+  RenderScaler(Display* display, XRenderPictFormat* format, XRenderPictFormat* mask_format,
+               XRenderPictFormat* argb_format);
+  // Sets the transform from target to source coordinates and a filter that
+  // averages all the source pixels of a target pixel.
+  void SetScaling(Picture picture, double x_scale, double y_scale);
+
+  Display* const display_;                // not owned
+  XRenderPictFormat* const format_;       // Default visual, owned by Xlib.
+  XRenderPictFormat* const mask_format_;  // Depth 1 bitmaps.
+  XRenderPictFormat* const argb_format_;  // Scaled icons.
+};
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ *  shmImage.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include "shmImage.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <X11/Xutil.h>
+
+const char kShmAttachError[] = "Could not attach shared memory, reading icons through the socket.\n";
+
+// Segments are allocated in multiples of this size.
+const size_t kShmSegmentGranularity = 64 * 1024;
+// Images larger than this are read through the socket.
+const size_t kMaxShmSegmentSize = 4 * 1024 * 1024;
+
+// Set by CatchShmError while a segment is being attached.
+static bool shmAttachFailed = false;
+
+static int CatchShmError(Display* /*display*/, XErrorEvent* /*error*/) {
+  shmAttachFailed = true;
+  return 0;
+}
+
+// Whether the display is reached through a Unix socket. Over TCP, even to
+// localhost as with ssh forwarding, the server may be on another machine and
+// attaching a segment would at best fail, at worst attach an unrelated one.
+static bool IsLocalDisplay(Display* display) {
+  struct sockaddr_storage address;
+  socklen_t length = sizeof(address);
+  if (getsockname(ConnectionNumber(display), reinterpret_cast<struct sockaddr*>(&address),
+                  &length) == 0) {
+    return address.ss_family == AF_UNIX;
+  }
+  // Fall back on the name: local displays are ":0", "unix:0" or, with
+  // launchd, the path of the socket.
+  const char* const name = DisplayString(display);
+  const char* const colon = strrchr(name, ':');
+  if (colon == nullptr) {
+    return false;
+  }
+  const size_t host = colon - name;
+  return host == 0 || name[0] == '/' || (host == 4 && strncmp(name, "unix", 4) == 0);
+}
+
+ShmImageReader* ShmImageReader::Create(Display* display) {
+  if (!IsLocalDisplay(display) || !XShmQueryExtension(display)) {
+    return nullptr;
+  }
+  return new ShmImageReader(display);
+}
+
+ShmImageReader::ShmImageReader(Display* display)
+: display_(display), segment_(), size_(0), usable_(true), budget_(nullptr), used_(0) {
+  segment_.shmid = -1;
+}
+
+ShmImageReader::~ShmImageReader() {
+  SetBudget(nullptr);
+}
+
+void ShmImageReader::SetBudget(CacheBudget* budget) {
+  Release();
+  if (budget_ != nullptr) {
+    budget_->Unregister(this);
+  }
+  budget_ = budget;
+  if (budget_ != nullptr) {
+    budget_->Register(this);
+  }
+}
+
+void ShmImageReader::Abandon() {
+  if (size_ > 0) {
+    shmdt(segment_.shmaddr);
+    segment_.shmid = -1;
+    Uncharge(size_);
+    size_ = 0;
+  }
+  usable_ = false;
+}
+
+bool ShmImageReader::OldestUse(uint64_t* tick) const {
+  if (size_ == 0) {
+    return false;
+  }
+  *tick = used_;
+  return true;
+}
+
+bool ShmImageReader::Reserve(size_t size) {
+  if (size <= size_) {
+    return true;
+  }
+  Release();
+  const size_t rounded = (size + kShmSegmentGranularity - 1) / kShmSegmentGranularity *
+      kShmSegmentGranularity;
+  // Without room in the budget, images are read through the socket.
+  if (budget_ != nullptr && !budget_->Charge(rounded)) {
+    return false;
+  }
+  segment_.shmid = shmget(IPC_PRIVATE, rounded, IPC_CREAT | 0600);
+  if (segment_.shmid < 0) {
+    perror("shmget");
+    Uncharge(rounded);
+    return false;
+  }
+  segment_.shmaddr = static_cast<char*>(shmat(segment_.shmid, nullptr, 0));
+  if (segment_.shmaddr == reinterpret_cast<char*>(-1)) {
+    perror("shmat");
+    shmctl(segment_.shmid, IPC_RMID, nullptr);
+    segment_.shmid = -1;
+    Uncharge(rounded);
+    return false;
+  }
+  segment_.readOnly = False;
+  // A remote server cannot attach the segment, the failure is only reported
+  // asynchronously, hence the synchronisation with a temporary handler.
+  shmAttachFailed = false;
+  XSync(display_, False);
+  int (*const previous)(Display*, XErrorEvent*) = XSetErrorHandler(CatchShmError);
+  XShmAttach(display_, &segment_);
+  XSync(display_, False);
+  XSetErrorHandler(previous);
+  // The segment goes away once both sides are detached.
+  shmctl(segment_.shmid, IPC_RMID, nullptr);
+  if (shmAttachFailed) {
+    fprintf(stderr, kShmAttachError);
+    shmdt(segment_.shmaddr);
+    segment_.shmid = -1;
+    usable_ = false;
+    Uncharge(rounded);
+    return false;
+  }
+  size_ = rounded;
+  return true;
+}
+
+void ShmImageReader::Release() {
+  if (size_ == 0) {
+    return;
+  }
+  XShmDetach(display_, &segment_);
+  shmdt(segment_.shmaddr);
+  segment_.shmid = -1;
+  Uncharge(size_);
+  size_ = 0;
+}
+
+void ShmImageReader::Uncharge(size_t size) {
+  if (budget_ != nullptr) {
+    budget_->Release(size);
+  }
+}
+
+ShmSeg ShmImageReader::AcquireSegment(size_t size) {
+  if (!usable_ || size > kMaxShmSegmentSize || !Reserve(size)) {
+    return 0;
+  }
+  if (budget_ != nullptr) {
+    used_ = budget_->Tick();
+  }
+  return segment_.shmseg;
+}
+
+XImage* ShmImageReader::GetImage(Drawable drawable, unsigned int width, unsigned int height,
+                                 unsigned int depth) {
+  if (!usable_) {
+    return nullptr;
+  }
+  Visual* const visual = DefaultVisual(display_, DefaultScreen(display_));
+  XImage* const shared = XShmCreateImage(display_, visual, depth, ZPixmap, nullptr, &segment_,
+                                         width, height);
+  if (shared == nullptr) {
+    return nullptr;
+  }
+  const size_t size = static_cast<size_t>(shared->bytes_per_line) * height;
+  if (AcquireSegment(size) == 0) {
+    XDestroyImage(shared);
+    return nullptr;
+  }
+  shared->data = segment_.shmaddr;
+  XImage* image = nullptr;
+  if (XShmGetImage(display_, drawable, shared, 0, 0, AllPlanes)) {
+    // The segment is reused by the next capture, the image gets its own copy.
+    char* const data = static_cast<char*>(malloc(size));
+    memcpy(data, segment_.shmaddr, size);
+    image = XCreateImage(display_, visual, depth, ZPixmap, 0, data, width, height,
+                         shared->bitmap_pad, shared->bytes_per_line);
+    if (image == nullptr) {
+      free(data);
+    }
+  }
+  shared->data = nullptr;
+  XDestroyImage(shared);
+  return image;
+}
@@ -0,0 +1,69 @@
+/*
+ *  shmImage.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef XKBGROWL_SHM_IMAGE
+#define XKBGROWL_SHM_IMAGE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+
+#include "cacheBudget.h"
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Reads drawables through a MIT-SHM segment instead of the X socket. Only
+// works when the client and the server share memory, that is for local
+// displays. A single segment is kept and reused for all the images; it only
+// grows when an image does not fit. Once given a budget, the segment is
+// charged to it, and dropped when another cache needs the room.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class ShmImageReader : public CacheBudget::Client {
+public:
+  // Returns null if the display is not local or the server does not support
+  // MIT-SHM, images must then be read with XGetImage.
+  static ShmImageReader* Create(Display* display);
+  ~ShmImageReader();
+  // Copy of the content of drawable, null if shared memory cannot be used.
+  XImage* GetImage(Drawable drawable, unsigned int width, unsigned int height,
+                   unsigned int depth);
+  // For requests sent through XCB: id of the segment, holding at least size
+  // bytes, 0 if shared memory cannot be used. The server writes the image at
+  // data(), which stays valid until the reader is used again.
+  ShmSeg AcquireSegment(size_t size);
+  const char* data() const { return segment_.shmaddr; }
+  // False once the server refused to attach a segment, e.g. a remote display.
+  bool usable() const { return usable_; }
+  // Charges the segment to budget, not owned, null for none.
+  void SetBudget(CacheBudget* budget);
+  // Forgets the segment without telling the server, once the connection is
+  // lost. The reader is no longer usable.
+  void Abandon();
+
+  bool OldestUse(uint64_t* tick) const;
+  void EvictOldest() { Release(); }
+private:
+  explicit ShmImageReader(Display* display);
+  // Makes sure the segment holds at least size bytes.
+  bool Reserve(size_t size);
+  void Release();
+  // Gives size bytes back to the budget, if any.
+  void Uncharge(size_t size);
+
+  Display* const display_;  // not owned
+  XShmSegmentInfo segment_;
+  size_t size_;             // Size of the segment, 0 if there is none.
+  bool usable_;
+  CacheBudget* budget_;     // not owned, may be null
+  uint64_t used_;           // Last capture, see CacheBudget::Tick.
+};
+
+#endif
@@ -0,0 +1,293 @@
+/*
+ *  x11Impl.h
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Internal declarations shared by the X11 backends. This header pulls in the
+ *  Xlib headers and must therefore only be included by C++ translation units,
+ *  never by the Objective-C side.
+ */
+
+#ifndef XKBGROWL_X11_IMPL
+#define XKBGROWL_X11_IMPL
+
+#include "x11Util.h"
+#include "cacheBudget.h"
+#include "pixelConverter.h"
+#include "renderScaler.h"
+#include "shmImage.h"
+#include <list>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <X11/Xlib.h>
+#include <X11/XKBlib.h>
+
+const char kWindowNameError[] = "Could not retrieve name for window %lx.\n";
+const char kUnknownClientNameError[] = "Could not get client name for window %lx.\n";
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Attributes of the window associated with a bell event.
+// ─────────────────────────────────────────────────────────────────────────────
+
+struct WindowAttributes {
+  std::string title;                       // WM_NAME, empty if not set.
+  std::string host;                        // WM_CLIENT_MACHINE, empty if not set.
+  std::shared_ptr<const ImageProxy> icon;  // Window icon or null, shared with the cache.
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Least recently used cache of window attributes. Entries must be invalidated
+// by the owner when the window properties change or the window is destroyed.
+// Once given a budget, the icons of the entries are charged to it, counted as
+// ARGB pixels; entries are then also evicted to make room for other caches.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class WindowAttributeCache : public CacheBudget::Client {
+public:
+  explicit WindowAttributeCache(size_t capacity);
+  ~WindowAttributeCache();
+  // Charges the icons to budget, not owned, null for none. Only set while
+  // the cache is empty.
+  void SetBudget(CacheBudget* budget);
+  // Fills attributes and returns true if window is in the cache.
+  bool Lookup(Window window, WindowAttributes* attributes);
+  // Adds window to the cache, returns false if its icon does not fit in the
+  // budget and the window was not cached.
+  bool Insert(Window window, const WindowAttributes& attributes);
+  // Removes window from the cache, returns true if it was present.
+  bool Invalidate(Window window);
+  // Moves to windows the windows evicted, or refused by Insert, since the
+  // last call and not cached again since. The owner stops watching them.
+  void TakeDropped(std::vector<Window>* windows);
+  size_t size() const { return entries_.size(); }
+
+  bool OldestUse(uint64_t* tick) const;
+  void EvictOldest();
+private:
+  struct Entry {
+    Window window;
+    WindowAttributes attributes;
+    size_t bytes;   // Charged to the budget.
+    uint64_t used;  // Last lookup, see CacheBudget::Tick.
+  };
+  typedef std::list<Entry> EntryList;
+  void Erase(EntryList::iterator entry);
+
+  const size_t capacity_;
+  CacheBudget* budget_;  // not owned, may be null
+  EntryList entries_;  // Most recently used first.
+  std::unordered_map<Window, EntryList::iterator> index_;
+  std::vector<Window> dropped_;  // See TakeDropped.
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Colours of the pixel values of colormaps, as returned by XQueryColors.
+// Entries of a colormap are dropped when a ColormapNotify event mentions it.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class ColormapCache {
+public:
+  explicit ColormapCache(Display* display);
+  // Sets colours to the 0xffRRGGBB colour of each pixel. The pixels that are
+  // not cached yet are resolved with a single XQueryColors round trip; if it
+  // fails they are black and stay uncached.
+  void Resolve(Colormap colormap, const std::vector<unsigned long>& pixels,
+               std::vector<uint32_t>* colours);
+  // Forgets the colours of colormap, of all colormaps if it is None.
+  void Invalidate(Colormap colormap);
+private:
+  typedef std::unordered_map<unsigned long, uint32_t> ColourMap;
+  Display* const display_;  // not owned
+  std::unordered_map<Colormap, ColourMap> colormaps_;
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Image proxy implementation that holds two XImages. Colours are resolved
+// when the proxy is built, conversion does not talk to the server.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class XImageProxy : public ImageProxy {
+public:
+  XImageProxy(XImage* pixmap, XImage* mask, Display* display, Colormap color_map,
+              ColormapCache* colormaps);
+  ~XImageProxy();
+
+  void provideARGB(int x, int y, int width, int height, void* data) const;
+  bool pixelView(PixelView* view) const;
+private:
+  XImage* const pixmap_;  // Icon pixmap, owned.
+  XImage* const mask_;    // Mask pixmap, owned.
+  RowDecoder pixmap_decoder_;
+  std::unique_ptr<RowDecoder> mask_decoder_;  // null if there is no usable mask
+  bool bitmap_mask_;  // The mask is applied straight from its bits.
+  PixelMapper mapper_;
+  bool has_view_;  // Pixels can be read in place, see pixelView.
+  PixelView view_;
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Image proxy implementation that holds ARGB pixels, as found in _NET_WM_ICON.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class RawImageProxy : public ImageProxy {
+public:
+  // Pixels are 32 bit values in host order, alpha in the most significant byte.
+  RawImageProxy(int width, int height, const uint32_t* data);
+  // Takes over the content of pixels.
+  RawImageProxy(int width, int height, std::vector<uint32_t>* pixels);
+  ~RawImageProxy();
+
+  void provideARGB(int x, int y, int width, int height, void* const data) const;
+  bool pixelView(PixelView* view) const;
+private:
+  std::vector<uint32_t> pixels_;
+};
+
+// Copies the rectangle (x, y, width, height) of view as A, R, G, B bytes,
+// one row at a time.
+void CopyViewARGB(const PixelView& view, int x, int y, int width, int height, void* data);
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Bidirectional cache between atoms and their names. Atoms live as long as
+// the server, so entries never go stale; the cache is only bounded in size.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class AtomCache {
+public:
+  explicit AtomCache(Display* display);
+  // Interns all names with a single XInternAtoms round trip.
+  void Preload(const char* const* names, int count);
+  Atom Intern(const std::string& name);
+  // Name of an atom, empty string for None.
+  const std::string& Name(Atom atom);
+private:
+  void Insert(Atom atom, const std::string& name);
+
+  Display* const display_;  // not owned
+  std::unordered_map<std::string, Atom> atoms_;
+  std::unordered_map<Atom, std::string> names_;
+};
+
+// Atoms interned when the display is opened.
+enum WellKnownAtom {
+  kNetWmIconAtom,
+  kNumWellKnownAtoms
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Concrete implementation of the X11 display wrapper, based on Xlib.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class X11DisplayDataImpl : public X11DisplayData {
+
+private:
+  X11DisplayDataImpl& operator=(const X11DisplayDataImpl& other) {return *this;}
+protected:
+  Display* display_;  // not owned
+  int xkbOpcode_;
+  int xkbEventCode_;
+  int iconSize_;  // Preferred size when a window provides several icons.
+  std::unique_ptr<AtomCache> atoms_;
+  std::unique_ptr<ColormapCache> colormaps_;
+  std::unique_ptr<ShmImageReader> shm_;  // null if MIT-SHM is not supported
+  std::unique_ptr<RenderScaler> render_;  // null unless icons are scaled by the server
+  Atom wellKnownAtoms_[kNumWellKnownAtoms];
+  WindowAttributeCache windowCache_;
+  BellRateLimiter* limiter_;  // not owned, may be null
+  bool connected_;  // False once the connection is lost, see HandleConnectionLost.
+
+  // Reads the events already received, returns true if one is a bell notification.
+  bool PollXkbBellEvent(XkbEvent* event);
+  // Waits at most timeout ms, forever if negative, for the connection to be
+  // readable. Returns false if poll fails or is interrupted by a signal.
+  bool WaitForEvents(int timeout);
+  // Processes an event that is not a bell notification.
+  void HandleEvent(const XEvent& event);
+  // Attributes of window, from the cache if possible.
+  void GetCachedAttributes(Window window, WindowAttributes* attributes);
+  // Fetches the attributes of windows and adds them to the cache.
+  void FetchAndCacheAttributes(const std::vector<Window>& windows,
+                               std::vector<WindowAttributes>* attributes);
+  // Window attributes of a bell event are read from, root if none is set.
+  Window AttributeWindow(const XkbBellNotifyEvent& event);
+  Atom KnownAtom(WellKnownAtom atom) const { return wellKnownAtoms_[atom]; }
+  // Icon of drawable, masked by mask, shrunk by the server. Null if the
+  // drawable is small enough or server side scaling is not possible.
+  ImageProxy* ServerScaledIcon(Drawable drawable, Drawable mask, unsigned int width,
+                               unsigned int height, unsigned int depth);
+  // Fetches the title, host and icon of window, one request at a time.
+  virtual void GetAttributesFromWindow(Window window, WindowAttributes* attributes);
+  // Fetches the attributes of several windows, by default one after the other.
+  virtual void GetAttributesFromWindows(const std::vector<Window>& windows,
+                                        std::vector<WindowAttributes>* attributes);
+  // Called by Xlib, instead of exiting, when the connection is lost.
+  static void HandleConnectionLost(Display* display, void* data);
+public:
+  X11DisplayDataImpl(const std::string& programName, const std::string& displayName);
+  virtual ~X11DisplayDataImpl();
+  // Connects to the display, returns false, after printing why, on failure.
+  virtual bool Open();
+  virtual BellEvent* NextBellEvent();
+  virtual BellEvent* NextBellEvent(int timeout);
+  virtual BellEvent* TryNextBellEvent();
+  virtual size_t NextBellEvents(size_t max, std::vector<std::unique_ptr<BellEvent> >* events);
+  virtual int FileDescriptor() const;
+  virtual bool HasQueuedEvents();
+  Display* display() { return display_; }
+  virtual void SendBellEvent(const std::string& name);
+  virtual void SetIconSize(int size);
+  virtual void SetServerScaling(bool enabled);
+  virtual void SetRateLimiter(BellRateLimiter* limiter);
+  virtual void SetCacheBudget(CacheBudget* budget);
+  virtual bool connected() const { return connected_; }
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// _NET_WM_ICON parsing, shared by both backends.
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Length, in 32 bit units, of the first _NET_WM_ICON request. Large enough to
+// hold all the icons up to 128 × 128 usually published by toolkits.
+const size_t kNetWmIconChunkLength = 32 * 1024;
+
+// Reads part of a CARDINAL window property, offset and length in 32 bit units.
+class CardinalReader {
+public:
+  virtual ~CardinalReader() {}
+  virtual bool Read(size_t offset, size_t length, std::vector<uint32_t>* values) = 0;
+};
+
+// Position of one icon inside the _NET_WM_ICON property.
+struct NetWmIconEntry {
+  uint32_t width;
+  uint32_t height;
+  size_t offset;  // Offset of the first pixel, in 32 bit units.
+};
+
+// Index of the icon closest to target_size, preferring larger icons to smaller.
+size_t SelectNetWmIcon(const std::vector<NetWmIconEntry>& icons, int target_size);
+
+// Builds the icon closest to target_size. chunk holds the first values of the
+// property, total_length its full length; reader fetches whatever is missing.
+ImageProxy* ReadNetWmIcon(const uint32_t* chunk, size_t chunk_length, size_t total_length,
+                          int target_size, CardinalReader* reader);
+
+// Factory for the XCB backend, defined in xcbDisplay.cpp. The display is not
+// opened yet.
+X11DisplayDataImpl* NewXcbDisplayData(const std::string& programName,
+                                      const std::string& displayName);
+
+// Fetches the content of a drawable, through shm if possible, else using XGetImage.
+XImage* GetImage(Display* display, Drawable drawable, ShmImageReader* shm = nullptr);
+// Same, for a drawable whose geometry is already known.
+XImage* GetImage(Display* display, Drawable drawable, unsigned int width, unsigned int height,
+                 unsigned int depth, ShmImageReader* shm);
+
+#endif
@@ -10,11 +10,20 @@
 
 
 #include "x11Util.h"
+#include "x11Impl.h"
+#include "rateLimiter.h"
 #include <assert.h>
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sysexits.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
 #include <X11/Xlib.h>
 #include <X11/XKBlib.h>
 #include <X11/extensions/XKBfile.h>
@@ -31,9 +40,7 @@ const char kConnectionRefusedFormat[] = "Could not connect to display %s.\n";
 const char kNonXkbServerFormat[] = "X11 Server %s does not support XKB.\n";
 const char kUnknownErrorFormat[] = "Unknown error %d while opening display %s.\n";
 const char kSelectEventErrorFormat[] = "Could not get XKB bell events for display %s.\n";
-const char kWindowNameError[] = "Could not retrieve name for window %lx.\n";
-
-const char kUnknownClientNameError[] = "Could not get client name for window %lx.\n";
+const char kConnectionLostFormat[] = "Lost the connection to display %s.\n";
 const char kEmptyString[] = "";
 
 
@@ -41,6 +48,12 @@ const char kEmptyString[] = "";
 // Abstract classes methods
 // ─────────────────────────────────────────────────────────────────────────────
 
+static std::atomic<uint64_t> nextImageGeneration(1);
+
+ImageProxy::ImageProxy(int width, int height)
+: width_(width), height_(height),
+  generation_(nextImageGeneration.fetch_add(1, std::memory_order_relaxed)) {}
+
 BellEvent::BellEvent() {}
 BellEvent::~BellEvent() {}
 
@@ -49,29 +62,16 @@ X11DisplayData::X11DisplayData(const std::string& programName,
 
 X11DisplayData::~X11DisplayData() {}
 
-// ─────────────────────────────────────────────────────────────────────────────
-// Concrete implementation of the X11 display wrapper.
-// ─────────────────────────────────────────────────────────────────────────────
-class X11DisplayDataImpl : public X11DisplayData {
-  
-private:
-  X11DisplayDataImpl& operator=(const X11DisplayDataImpl& other) {return *this;}
-protected:
-  Display* display_;  // not owned
-  int xkbOpcode_;
-  int xkbEventCode_;
-public:
-  X11DisplayDataImpl(const std::string& programName, const std::string& displayName);
-  virtual ~X11DisplayDataImpl();
-  virtual BellEvent* NextBellEvent();
-  Display* display() { return display_; }
-  virtual void SendBellEvent(const std::string& name);
-};
-
-
 X11DisplayData* X11DisplayData::GetDisplayData(const std::string& programName,
-                                               const std::string& displayName) {
-  return new X11DisplayDataImpl(programName, displayName);
+                                               const std::string& displayName,
+                                               X11Backend backend) {
+  std::unique_ptr<X11DisplayDataImpl> display(
+      backend == kXcbBackend ? NewXcbDisplayData(programName, displayName)
+                             : new X11DisplayDataImpl(programName, displayName));
+  if (!display->Open()) {
+    return nullptr;
+  }
+  return display.release();
 }
 
 // Struct to store X11 version stuff.
@@ -80,6 +80,84 @@ struct X11Version {
   int minor;
 };
 
+// Maximum number of windows whose attributes are cached.
+const size_t kWindowCacheCapacity = 64;
+// Events selected on cached windows to invalidate their entry.
+const long kWatchedWindowMask = PropertyChangeMask | StructureNotifyMask | ColormapChangeMask;
+// Events selected on the root window, whose colormap is used for icons.
+const long kRootWindowMask = ColormapChangeMask;
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Atom cache
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Beyond this number of entries the cache is flushed, a client inventing a
+// new bell name for each event should not make the cache grow forever.
+const size_t kMaxCachedAtoms = 4096;
+
+// Atoms interned at connection time: the WellKnownAtom values, in order,
+// followed by the standard XKB bell names.
+const char* const kPreloadedAtoms[] = {
+  "_NET_WM_ICON",
+  XkbBN_Info, XkbBN_Warning, XkbBN_Question, XkbBN_Start, XkbBN_End, XkbBN_Success,
+  XkbBN_Failure, XkbBN_Wait, XkbBN_Proceed, XkbBN_Ignore, XkbBN_Iconify, XkbBN_Deiconify,
+  XkbBN_Open, XkbBN_Close, XkbBN_TerminalBell, XkbBN_MarginBell,
+};
+
+AtomCache::AtomCache(Display* display) : display_(display) {}
+
+void AtomCache::Insert(Atom atom, const std::string& name) {
+  if (names_.size() >= kMaxCachedAtoms) {
+    names_.clear();
+    atoms_.clear();
+  }
+  names_[atom] = name;
+  atoms_[name] = atom;
+}
+
+void AtomCache::Preload(const char* const* names, int count) {
+  std::vector<Atom> atoms(count);
+  if (!XInternAtoms(display_, const_cast<char**>(names), count, False, atoms.data())) {
+    fprintf(stderr, "Could not intern %d atoms.\n", count);
+  }
+  for (int i = 0; i < count; ++i) {
+    if (atoms[i] != None) {
+      Insert(atoms[i], names[i]);
+    }
+  }
+}
+
+Atom AtomCache::Intern(const std::string& name) {
+  std::unordered_map<std::string, Atom>::const_iterator it = atoms_.find(name);
+  if (it != atoms_.end()) {
+    return it->second;
+  }
+  const Atom atom = XInternAtom(display_, name.c_str(), False);
+  if (atom != None) {
+    Insert(atom, name);
+  }
+  return atom;
+}
+
+const std::string& AtomCache::Name(Atom atom) {
+  static const std::string kNoName;
+  if (atom == None) {
+    return kNoName;
+  }
+  std::unordered_map<Atom, std::string>::const_iterator it = names_.find(atom);
+  if (it != names_.end()) {
+    return it->second;
+  }
+  // XGetAtomName -> must be freed with XFree().
+  char* const name = XGetAtomName(display_, atom);
+  if (name == nullptr) {
+    return kNoName;
+  }
+  Insert(atom, name);
+  XFree(name);
+  return names_[atom];
+}
+
 // ─────────────────────────────────────────────────────────────────────────────
 // Constructor for the concrete implementation
 // Most of the code is for error handling
@@ -92,75 +170,277 @@ int handleError(Display* display, XErrorEvent* error) {
   return 0;
 }
 
+// Xlib calls this first when a connection breaks, then the exit handler of
+// the display. Neither exits: Xlib 1.7 and later then return from the call
+// that failed, and the later calls on the display fail without talking to
+// the server. The message is printed by HandleConnectionLost.
+static int HandleIOError(Display* /*display*/) {
+  return 0;
+}
+
+void X11DisplayDataImpl::HandleConnectionLost(Display* /*display*/, void* data) {
+  X11DisplayDataImpl* const self = static_cast<X11DisplayDataImpl*>(data);
+  if (self->connected_) {
+    self->connected_ = false;
+    fprintf(stderr, kConnectionLostFormat, self->displayName_.c_str());
+  }
+}
+
 X11DisplayDataImpl::X11DisplayDataImpl(
                                        const std::string& programName,
                                        const std::string& displayName)
-: X11DisplayData(programName, displayName), display_(nullptr), xkbOpcode_(0), xkbEventCode_(0) {
+: X11DisplayData(programName, displayName), display_(nullptr), xkbOpcode_(0), xkbEventCode_(0),
+  iconSize_(kNotificationIconSize), windowCache_(kWindowCacheCapacity), limiter_(nullptr),
+  connected_(false) {}
+
+bool X11DisplayDataImpl::Open() {
   X11Version version = { XkbMajorVersion, XkbMinorVersion };
   int error = 0;
-  display_ = XkbOpenDisplay(const_cast<char *>(displayName.c_str()), &xkbEventCode_,
+  display_ = XkbOpenDisplay(const_cast<char *>(displayName_.c_str()), &xkbEventCode_,
                             nullptr, &version.major, &version.minor, &error);
   if (display_ == nullptr) {
     switch (error) {
       case XkbOD_BadLibraryVersion:
-        fprintf(stderr, kWrongVersionFormat, programName.c_str(), XkbMajorVersion,
+        fprintf(stderr, kWrongVersionFormat, programName_.c_str(), XkbMajorVersion,
                 XkbMinorVersion, version.major, version.minor, "library");
-        exit(EX_CONFIG);
+        break;
       case XkbOD_BadServerVersion:
-        fprintf(stderr, kWrongVersionFormat, programName.c_str(), XkbMajorVersion,
-                XkbMinorVersion, version.major, version.minor, displayName.c_str());
-        exit(EX_CONFIG);
+        fprintf(stderr, kWrongVersionFormat, programName_.c_str(), XkbMajorVersion,
+                XkbMinorVersion, version.major, version.minor, displayName_.c_str());
+        break;
       case XkbOD_ConnectionRefused:
-        fprintf(stderr, kConnectionRefusedFormat, displayName.c_str());
-        exit(EX_UNAVAILABLE);
+        fprintf(stderr, kConnectionRefusedFormat, displayName_.c_str());
+        break;
       case XkbOD_NonXkbServer:
-        fprintf(stderr, kNonXkbServerFormat, displayName.c_str());
-        exit(EX_UNAVAILABLE);
+        fprintf(stderr, kNonXkbServerFormat, displayName_.c_str());
+        break;
       default:
-        fprintf(stderr, kUnknownErrorFormat, error, displayName.c_str());
-        exit(EX_SOFTWARE);
+        fprintf(stderr, kUnknownErrorFormat, error, displayName_.c_str());
+        break;
     } // switch
+    return false;
   }
+  connected_ = true;
+  XSetIOErrorHandler(HandleIOError);
+  XSetIOErrorExitHandler(display_, HandleConnectionLost, this);
   int eventMask = XkbBellNotifyMask;
   if (!XkbSelectEvents(display_, XkbUseCoreKbd, eventMask, eventMask)) {
-    fprintf(stderr, kSelectEventErrorFormat, displayName.c_str());
-    exit(EX_SOFTWARE);
+    fprintf(stderr, kSelectEventErrorFormat, displayName_.c_str());
+    return false;
   }
   XSetErrorHandler(handleError);
+  atoms_.reset(new AtomCache(display_));
+  atoms_->Preload(kPreloadedAtoms, sizeof(kPreloadedAtoms) / sizeof(kPreloadedAtoms[0]));
+  for (int i = 0; i < kNumWellKnownAtoms; ++i) {
+    wellKnownAtoms_[i] = atoms_->Intern(kPreloadedAtoms[i]);
+  }
+  colormaps_.reset(new ColormapCache(display_));
+  shm_.reset(ShmImageReader::Create(display_));
+  XSelectInput(display_, RootWindow(display_, DefaultScreen(display_)), kRootWindowMask);
+  return true;
 }
 
 void X11DisplayDataImpl::SendBellEvent(const std::string& name) {
-  const Atom bellname_ = XInternAtom(display(), name.c_str(), False);
+  const Atom bellname_ = atoms_->Intern(name);
   XkbBellEvent(display(), None, 100, bellname_);
 }
 
+void X11DisplayDataImpl::SetIconSize(int size) {
+  iconSize_ = size;
+}
+
+void X11DisplayDataImpl::SetRateLimiter(BellRateLimiter* limiter) {
+  limiter_ = limiter;
+}
+
+void X11DisplayDataImpl::SetServerScaling(bool enabled) {
+  if (!enabled) {
+    render_.reset();
+  } else if (!render_) {
+    render_.reset(RenderScaler::Create(display_));
+    if (!render_) {
+      fprintf(stderr, "No XRender on %s, icons are scaled locally.\n", displayName_.c_str());
+    }
+  }
+}
+
+void X11DisplayDataImpl::SetCacheBudget(CacheBudget* budget) {
+  windowCache_.SetBudget(budget);
+  if (shm_) {
+    shm_->SetBudget(budget);
+  }
+}
+
 X11DisplayDataImpl::~X11DisplayDataImpl() {
+  if (display_ == nullptr) {
+    return;
+  }
+  if (!connected_ && shm_) {
+    // The server is gone, only the local attachment of the segment is left.
+    shm_->Abandon();
+  }
+  shm_.reset();
+  render_.reset();
+  // Once the connection is lost, this only frees the display and its XCB
+  // connection.
   XCloseDisplay(display_);
 }
 
+// ─────────────────────────────────────────────────────────────────────────────
+// Colormap cache
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Serial of the XQueryColors request being checked, set by CatchQueryColorsError
+// if the request failed. Other errors go to the previous handler.
+static unsigned long queryColorsSerial = 0;
+static bool queryColorsFailed = false;
+static int (*queryColorsPrevious)(Display*, XErrorEvent*) = nullptr;
+
+static int CatchQueryColorsError(Display* display, XErrorEvent* error) {
+  if (error->serial == queryColorsSerial) {
+    queryColorsFailed = true;
+    return 0;
+  }
+  return queryColorsPrevious != nullptr ? queryColorsPrevious(display, error) : 0;
+}
+
+ColormapCache::ColormapCache(Display* display) : display_(display) {}
+
+void ColormapCache::Resolve(Colormap colormap, const std::vector<unsigned long>& pixels,
+                            std::vector<uint32_t>* colours) {
+  ColourMap& known = colormaps_[colormap];
+  std::vector<XColor> missing;
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    if (known.find(pixels[i]) == known.end()) {
+      XColor color = XColor();
+      color.pixel = pixels[i];
+      missing.push_back(color);
+    }
+  }
+  bool failed = false;
+  if (!missing.empty()) {
+    // The reply, or the error, is read before XQueryColors returns.
+    queryColorsSerial = NextRequest(display_);
+    queryColorsFailed = false;
+    queryColorsPrevious = XSetErrorHandler(CatchQueryColorsError);
+    XQueryColors(display_, colormap, missing.data(), missing.size());
+    XSetErrorHandler(queryColorsPrevious);
+    failed = queryColorsFailed;
+  }
+  if (failed) {
+    // A bad pixel, or a colormap that went away, fails the whole request and
+    // leaves every colour zeroed: these pixels are drawn black this time but
+    // not cached, so that the next icon queries them again.
+    colours->resize(pixels.size());
+    for (size_t i = 0; i < pixels.size(); ++i) {
+      const ColourMap::const_iterator found = known.find(pixels[i]);
+      (*colours)[i] = found != known.end() ? found->second : 0xff000000;
+    }
+    if (known.empty()) {
+      colormaps_.erase(colormap);
+    }
+    return;
+  }
+  for (size_t i = 0; i < missing.size(); ++i) {
+    known[missing[i].pixel] = 0xff000000 | ((missing[i].red >> 8) << 16) |
+        ((missing[i].green >> 8) << 8) | (missing[i].blue >> 8);
+  }
+  colours->resize(pixels.size());
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    (*colours)[i] = known[pixels[i]];
+  }
+}
+
+void ColormapCache::Invalidate(Colormap colormap) {
+  if (colormap == None) {
+    colormaps_.clear();
+  } else {
+    colormaps_.erase(colormap);
+  }
+}
+
 // ─────────────────────────────────────────────────────────────────────────────
 // Image proxy implementation that holds two XImages
 // ─────────────────────────────────────────────────────────────────────────────
 
-class XImageProxy : public ImageProxy {
-public:
-  XImageProxy(XImage* pixmap, XImage* mask, Display* display, Colormap color_map);
-  ~XImageProxy();
-  
-  void provideARGB(int x, int y, int width, int height, void* data) const;
-private:
-  unsigned char* providePixel(int x, int y, unsigned char* p) const;
+// The images defined in the XImages for X logos should only be one bit, they
+// are drawn black on white whatever the colormap.
+const uint32_t kBitmapPalette[] = { 0xffffffff, 0xff000000 };
 
-  XImage* const pixmap_;  // Icon pixmap, owned.
-  XImage* const mask_;    // Mask pixmap, owned.
-  Display* const display_;  // Display, not owned.
-  Colormap color_map_;      // Colormap
-};
+// Visual describing the channels of an image of the given depth, if any.
+// Pixmaps need not have the default depth, for instance 32 bit icons on a 24
+// bit screen: their channels are those of a true colour visual of their depth.
+// Depths of 8 bits or less without such a visual go through the colormap.
+static const Visual* TrueColorVisual(Display* display, int depth) {
+  const int screen = DefaultScreen(display);
+  const Visual* const visual = DefaultVisual(display, screen);
+  if (DefaultDepth(display, screen) == depth) {
+    return visual->c_class == TrueColor ? visual : nullptr;
+  }
+  XVisualInfo info;
+  if (depth > 8 && XMatchVisualInfo(display, screen, depth, TrueColor, &info)) {
+    return info.visual;
+  }
+  return nullptr;
+}
 
-XImageProxy::XImageProxy(XImage* pixmap, XImage* mask, Display* display, Colormap color_map)
-: ImageProxy(pixmap->width, pixmap->height), pixmap_(pixmap), mask_(mask), display_(display), color_map_(color_map) {
+XImageProxy::XImageProxy(XImage* pixmap, XImage* mask, Display* display, Colormap color_map,
+                         ColormapCache* colormaps)
+: ImageProxy(pixmap->width, pixmap->height), pixmap_(pixmap), mask_(mask),
+  pixmap_decoder_(pixmap), bitmap_mask_(false),
+  mapper_(pixmap, TrueColorVisual(display, pixmap->depth)), has_view_(false), view_() {
   assert(display != nullptr);
   assert(pixmap != nullptr);
+  if (mask_ != nullptr) {
+    if (mask_->width >= width_ && mask_->height >= height_) {
+      mask_decoder_.reset(new RowDecoder(mask_));
+      // Same condition as the bitmap decoder: bits can be read byte by byte.
+      bitmap_mask_ = mask_->depth == 1 && mask_->bits_per_pixel == 1 &&
+          (mask_->bitmap_unit == 8 || mask_->byte_order == mask_->bitmap_bit_order);
+    } else {
+      fprintf(stderr, "Ignoring %dx%d mask of %dx%d icon.\n", mask_->width, mask_->height,
+              width_, height_);
+    }
+  }
+  // Unmasked 32 bit true colour images can be read in place.
+  if (!mask_decoder_ && mapper_.direct() && pixmap->format == ZPixmap &&
+      pixmap->bits_per_pixel == 32) {
+    has_view_ = true;
+    view_.data = reinterpret_cast<const unsigned char*>(pixmap->data);
+    view_.stride = pixmap->bytes_per_line;
+    view_.format = pixmap->byte_order == MSBFirst ? kPixelFormatXRGB : kPixelFormatBGRX;
+  }
+  if (!mapper_.indexed()) {
+    return;
+  }
+  const size_t palette_size = mapper_.palette_size();
+  if (pixmap->depth == 1) {
+    mapper_.SetPalette(std::vector<uint32_t>(kBitmapPalette, kBitmapPalette + 2));
+    return;
+  }
+  // Strangely enough, xterm provides 8 bit palette colour data. Only the
+  // pixel values used by the image are resolved, in one go.
+  std::vector<bool> used(palette_size, false);
+  std::vector<uint32_t> row(width_);
+  for (int y = 0; y < height_; ++y) {
+    pixmap_decoder_.Decode(0, y, width_, row.data());
+    for (int x = 0; x < width_; ++x) {
+      used[std::min<size_t>(row[x], palette_size - 1)] = true;
+    }
+  }
+  std::vector<unsigned long> pixels;
+  for (size_t pixel = 0; pixel < palette_size; ++pixel) {
+    if (used[pixel]) {
+      pixels.push_back(pixel);
+    }
+  }
+  std::vector<uint32_t> colours;
+  colormaps->Resolve(color_map, pixels, &colours);
+  std::vector<uint32_t> palette(palette_size, 0xff000000);
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    palette[pixels[i]] = colours[i];
+  }
+  mapper_.SetPalette(palette);
 }
 
 XImageProxy::~XImageProxy() {
@@ -172,53 +452,35 @@ XImageProxy::~XImageProxy() {
   }
 }
 
-// The images defined in the XImages for X logos should only be one bit.
-// Strangely enough, xterm provides 8 palette colour data.
-Status FakeXQueryColor(Display* display, Colormap color_map, XColor* color) {
-  if (color->pixel) {
-    color->red = 0x0000;
-    color->green = 0x0000;
-    color->blue = 0x0000;
-  } else {
-    color->red = 0xffff;
-    color->green = 0xffff;
-    color->blue = 0xffff;
+bool XImageProxy::pixelView(PixelView* view) const {
+  if (has_view_) {
+    *view = view_;
   }
-  return 1;
-}
-
-unsigned char* XImageProxy::providePixel(int x, int y, unsigned char* p) const {
-  assert(x < width_);
-  assert(y < height_);
-  XColor color;
-  color.pixel = XGetPixel(pixmap_, x, y);
-  const Status color_status = FakeXQueryColor(display_, color_map_, &color);
-  if (!color_status) {
-    fprintf(stderr, "Could not lookup pixel %d %d: %d", x, y, color_status);
-  }
-  // alpha
-  if (mask_ != nullptr) {
-    const unsigned long alpha_v = XGetPixel(mask_, x, y);
-    if (alpha_v) {
-      *p++ = 0xff;
-    } else {
-      *p++ = 0x00;
-    }
-  } else {
-    *p++ = 0xff;
-  }
-  *p++ = (color.red >> 8);
-  *p++ = (color.green >> 8);
-  *p++ = (color.blue >> 8);
-  return p;
+  return has_view_;
 }
 
 void XImageProxy::provideARGB(int x, int y, int width, int height, void* data) const {
+  if (has_view_) {
+    CopyViewARGB(view_, x, y, width, height, data);
+    return;
+  }
   unsigned char* p = static_cast<unsigned char*>(data);
+  std::vector<uint32_t> row(width);
+  std::vector<uint32_t> mask_row(mask_decoder_ && !bitmap_mask_ ? width : 0);
   for (int y_index = y; y_index < y + height; ++y_index) {
-    for (int x_index = x; x_index < x + width; ++x_index) {
-      p = providePixel(x_index, y_index, p);
+    pixmap_decoder_.Decode(x, y_index, width, row.data());
+    mapper_.Map(row.data(), width, row.data());
+    if (bitmap_mask_) {
+      const unsigned char* const bits =
+          reinterpret_cast<const unsigned char*>(mask_->data) + y_index * mask_->bytes_per_line;
+      ApplyBitmapMask(bits, x + mask_->xoffset, mask_->bitmap_bit_order == MSBFirst, width,
+                      row.data());
+    } else if (mask_decoder_) {
+      mask_decoder_->Decode(x, y_index, width, mask_row.data());
+      ApplyMask(mask_row.data(), width, row.data());
     }
+    StoreARGB(row.data(), width, p);
+    p += width * 4;
   }
 }
 
@@ -226,38 +488,120 @@ void XImageProxy::provideARGB(int x, int y, int width, int height, void* data) c
 // Image proxy implementation that holds raw rgb bytes
 // ─────────────────────────────────────────────────────────────────────────────
 
-class RawImageProxy : public ImageProxy {
-public:
-  RawImageProxy(int width, int height, const unsigned char* data);
-  ~RawImageProxy();
-  
-  void provideARGB(int x, int y, int width, int height, void* const data) const;
-private:
-  std::unique_ptr<unsigned char[]> pixels_;
-};
+RawImageProxy::RawImageProxy(int width, int height, const uint32_t* const data)
+:ImageProxy(width, height), pixels_(data, data + size_t(width) * height) {}
 
-RawImageProxy::RawImageProxy(int width, int height, const unsigned char* const data)
+RawImageProxy::RawImageProxy(int width, int height, std::vector<uint32_t>* pixels)
 :ImageProxy(width, height) {
-  const size_t num_bytes = width * height * 4;
-  pixels_.reset(new unsigned char[num_bytes]);
-  memcpy(pixels_.get(), data, num_bytes);
+  assert(pixels->size() >= size_t(width) * height);
+  pixels_.swap(*pixels);
 }
 
 RawImageProxy::~RawImageProxy() {}
 
+bool RawImageProxy::pixelView(PixelView* view) const {
+  view->data = reinterpret_cast<const unsigned char*>(pixels_.data());
+  view->stride = width_ * sizeof(uint32_t);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  view->format = kPixelFormatBGRA;
+#else
+  view->format = kPixelFormatARGB;
+#endif
+  return true;
+}
+
 void RawImageProxy::provideARGB(int x, int y, int width, int height, void* const data) const {
-  unsigned char* dest = static_cast<unsigned char *>(data);
-  for(int yd = 0; yd < height; ++yd) {
-    for(int xd = 0; xd < width; ++xd) {
-      const int p = (((yd + y) * width) + (xd + x)) * 4;
-      for (int c = 0; c < 4; ++c) {
-        *dest = pixels_[p + c];
-        ++dest;
+  PixelView view;
+  pixelView(&view);
+  CopyViewARGB(view, x, y, width, height, data);
+}
+
+void CopyViewARGB(const PixelView& view, int x, int y, int width, int height, void* data) {
+  unsigned char* dest = static_cast<unsigned char*>(data);
+  const unsigned char* row = view.data + y * view.stride + x * 4;
+  for (int yd = 0; yd < height; ++yd) {
+    ConvertToARGB(row, view.format, width, dest);
+    row += view.stride;
+    dest += width * 4;
+  }
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// _NET_WM_ICON parsing. The property is a sequence of icons, each encoded as
+// width, height followed by width × height ARGB pixels. The first chunk of the
+// property is read in one request; headers and pixels that lie beyond it are
+// fetched with small offset requests, and only for the icon that is selected.
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Sanity bound on icon dimensions, guards against corrupted properties.
+const uint32_t kMaxNetWmIconDimension = 4096;
+
+size_t SelectNetWmIcon(const std::vector<NetWmIconEntry>& icons, int target_size) {
+  assert(!icons.empty());
+  const uint32_t target = target_size;
+  size_t best = 0;
+  for (size_t i = 1; i < icons.size(); ++i) {
+    const NetWmIconEntry& candidate = icons[i];
+    const NetWmIconEntry& current = icons[best];
+    const bool candidate_fits = std::min(candidate.width, candidate.height) >= target;
+    const bool current_fits = std::min(current.width, current.height) >= target;
+    const uint64_t candidate_area = uint64_t(candidate.width) * candidate.height;
+    const uint64_t current_area = uint64_t(current.width) * current.height;
+    if (candidate_fits != current_fits) {
+      // Downscaling looks better than upscaling.
+      if (candidate_fits) {
+        best = i;
       }
+    } else if (candidate_fits ? candidate_area < current_area : candidate_area > current_area) {
+      best = i;
     }
   }
+  return best;
 }
 
+ImageProxy* ReadNetWmIcon(const uint32_t* chunk, size_t chunk_length, size_t total_length,
+                          int target_size, CardinalReader* reader) {
+  std::vector<NetWmIconEntry> icons;
+  size_t offset = 0;
+  while (offset + 2 <= total_length) {
+    uint32_t header[2];
+    if (offset + 2 <= chunk_length) {
+      header[0] = chunk[offset];
+      header[1] = chunk[offset + 1];
+    } else {
+      std::vector<uint32_t> values;
+      if (!reader->Read(offset, 2, &values) || values.size() < 2) {
+        break;
+      }
+      header[0] = values[0];
+      header[1] = values[1];
+    }
+    const NetWmIconEntry entry = { header[0], header[1], offset + 2 };
+    if (entry.width == 0 || entry.height == 0 || entry.width > kMaxNetWmIconDimension ||
+        entry.height > kMaxNetWmIconDimension) {
+      break;
+    }
+    const size_t num_pixels = size_t(entry.width) * entry.height;
+    if (entry.offset + num_pixels > total_length) {
+      break;
+    }
+    icons.push_back(entry);
+    offset = entry.offset + num_pixels;
+  }
+  if (icons.empty()) {
+    return nullptr;
+  }
+  const NetWmIconEntry& icon = icons[SelectNetWmIcon(icons, target_size)];
+  const size_t num_pixels = size_t(icon.width) * icon.height;
+  if (icon.offset + num_pixels <= chunk_length) {
+    return new RawImageProxy(icon.width, icon.height, chunk + icon.offset);
+  }
+  std::vector<uint32_t> pixels;
+  if (!reader->Read(icon.offset, num_pixels, &pixels) || pixels.size() < num_pixels) {
+    return nullptr;
+  }
+  return new RawImageProxy(icon.width, icon.height, &pixels);
+}
 
 // ─────────────────────────────────────────────────────────────────────────────
 // Concrete implementation of the BellEvent class
@@ -265,7 +609,8 @@ void RawImageProxy::provideARGB(int x, int y, int width, int height, void* const
 
 class BellEventImpl : public BellEvent {
 public:
-  BellEventImpl(X11DisplayDataImpl* data);
+  BellEventImpl(const XkbBellNotifyEvent& event, const std::string& name,
+                const WindowAttributes& attributes, const std::string& displayName);
   virtual ~BellEventImpl();
   virtual std::string name() const;
   virtual std::string windowName() const;
@@ -276,57 +621,65 @@ public:
   virtual int bellId() const;
   virtual bool eventOnly() const;
   virtual std::string hostName() const;
-  virtual ImageProxy* imageProxy();
+  virtual std::string displayName() const;
+  virtual unsigned long window() const;
+  virtual const ImageProxy* imageProxy() const;
 
 protected:
-  
-  inline Display* display();
-  inline Window window();
-  void GetAttributesFromWindow(Window window);
-  
-  X11DisplayDataImpl* data_;
-  XkbEvent event_;
-  char* name_; 
-  char* windowName_;
-  XTextProperty hostName_;
-  XWMHints* wmHints_;
-  std::unique_ptr<ImageProxy> image_proxy_;
+  const XkbBellNotifyEvent event_;
+  const std::string name_;
+  const WindowAttributes attributes_;
+  const std::string displayName_;
 };
 
-// Constructor, gets the event from the display
-BellEventImpl::BellEventImpl(X11DisplayDataImpl* data) : 
-    data_(data), event_(), name_(nullptr), windowName_(nullptr),
-    wmHints_(nullptr) {
-  XNextEvent(display(), &event_.core);
-  if (event_.bell.name) {
-    // XGetAtomName -> must be freed with XFree().
-    name_ = XGetAtomName(data_->display(), event_.bell.name);
-  }
-  if (window()) {
-    GetAttributesFromWindow(window());
-  } else {
-    const int screen = DefaultScreen(display());
-    const Window root = RootWindow(display(), screen);
-    GetAttributesFromWindow(root);
-  }  
-}
+BellEventImpl::BellEventImpl(const XkbBellNotifyEvent& event, const std::string& name,
+                             const WindowAttributes& attributes, const std::string& displayName) :
+    event_(event), name_(name), attributes_(attributes), displayName_(displayName) {}
 
-BellEventImpl::~BellEventImpl() {
-  if (name_) {
-    XFree(name_);
-    name_ = nullptr;
-  }
-  if (windowName_) {
-    XFree(windowName_);
-    windowName_ = nullptr;
+BellEventImpl::~BellEventImpl() {}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Reads a CARDINAL property with XGetWindowProperty.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class XlibCardinalReader : public CardinalReader {
+public:
+  XlibCardinalReader(Display* display, Window window, Atom property)
+  : display_(display), window_(window), property_(property) {}
+  virtual bool Read(size_t offset, size_t length, std::vector<uint32_t>* values) {
+    return Read(offset, length, values, nullptr);
   }
-  if (wmHints_) {
-    XFree(wmHints_);
-    wmHints_ = nullptr;
+  // Also returns the total length of the property, in 32 bit units.
+  bool Read(size_t offset, size_t length, std::vector<uint32_t>* values, size_t* total_length);
+private:
+  Display* const display_;
+  const Window window_;
+  const Atom property_;
+};
+
+bool XlibCardinalReader::Read(size_t offset, size_t length, std::vector<uint32_t>* values,
+                              size_t* total_length) {
+  unsigned long nitems = 0;
+  unsigned long bytesafter = 0;
+  unsigned char* result = nullptr;
+  int format = 0;
+  Atom type = None;
+  const int status = XGetWindowProperty(display_, window_, property_, offset, length, False,
+                                        XA_CARDINAL, &type, &format, &nitems, &bytesafter,
+                                        &result);
+  if (status != Success || result == nullptr) {
+    return false;
   }
-  if (hostName_.value) {
-    XFree(hostName_.value);
+  const bool valid = type == XA_CARDINAL && format == 32;
+  if (valid) {
+    values->resize(nitems);
+    PackCardinals(reinterpret_cast<unsigned long*>(result), nitems, values->data());
+    if (total_length) {
+      *total_length = offset + nitems + bytesafter / 4;
+    }
   }
+  XFree(result);
+  return valid;
 }
 
 // ─────────────────────────────────────────────────────────────────────────────
@@ -335,150 +688,504 @@ BellEventImpl::~BellEventImpl() {
 // • Window icon
 // ─────────────────────────────────────────────────────────────────────────────
 
-XImage* GetImage(Display* display, Drawable drawable) {
+// Geometry of a drawable, as needed to fetch its content.
+struct DrawableGeometry {
+  unsigned int width;
+  unsigned int height;
+  unsigned int depth;
+};
+
+static bool GetDrawableGeometry(Display* display, Drawable drawable, DrawableGeometry* geometry) {
   Window root;
   int x, y;
-  unsigned int width, height;
-  unsigned int border, depth;
-  const Status status = XGetGeometry(display, drawable,
-                                     &root, &x, &y,  &width, &height, &border, &depth);
-  if (status) {
-    // XGetImage does not work for windows that are not somehow mapped.
-    XImage* image = XGetImage(display, drawable, 0, 0, width, height, AllPlanes, ZPixmap);
+  unsigned int border;
+  return XGetGeometry(display, drawable, &root, &x, &y, &geometry->width, &geometry->height,
+                      &border, &geometry->depth) != 0;
+}
+
+XImage* GetImage(Display* display, Drawable drawable, ShmImageReader* shm) {
+  DrawableGeometry geometry = {};
+  if (GetDrawableGeometry(display, drawable, &geometry)) {
+    return GetImage(display, drawable, geometry.width, geometry.height, geometry.depth, shm);
+  }
+  return nullptr;
+}
+
+XImage* GetImage(Display* display, Drawable drawable, unsigned int width, unsigned int height,
+                 unsigned int depth, ShmImageReader* shm) {
+  if (depth == 1) {
+    // Bitmaps, like most icon masks: a single plane is all there is to
+    // transfer, whatever pixel size the server uses for depth 1 pixmaps.
+    XImage* image = XGetImage(display, drawable, 0, 0, width, height, 1, XYPixmap);
     if (!image) {
-      fprintf(stderr, "XGetImage failed for drawable %lx\n", drawable);
+      fprintf(stderr, "XGetImage failed for bitmap %lx\n", drawable);
     }
     return image;
   }
-  return nullptr;
+  if (shm != nullptr) {
+    XImage* const image = shm->GetImage(drawable, width, height, depth);
+    if (image) {
+      return image;
+    }
+  }
+  // XGetImage does not work for windows that are not somehow mapped.
+  XImage* image = XGetImage(display, drawable, 0, 0, width, height, AllPlanes, ZPixmap);
+  if (!image) {
+    fprintf(stderr, "XGetImage failed for drawable %lx\n", drawable);
+  }
+  return image;
 }
 
-void BellEventImpl::GetAttributesFromWindow(Window window) {
+ImageProxy* X11DisplayDataImpl::ServerScaledIcon(Drawable drawable, Drawable mask,
+                                                 unsigned int width, unsigned int height,
+                                                 unsigned int depth) {
+  if (!render_) {
+    return nullptr;
+  }
+  std::vector<uint32_t> pixels;
+  int scaled_width = 0;
+  int scaled_height = 0;
+  if (!render_->Scale(drawable, mask, width, height, depth, iconSize_, &pixels,
+                      &scaled_width, &scaled_height)) {
+    return nullptr;
+  }
+  return new RawImageProxy(scaled_width, scaled_height, &pixels);
+}
+
+void X11DisplayDataImpl::GetAttributesFromWindow(Window window, WindowAttributes* attributes) {
   assert(window);
-  const Status nameStatus = XFetchName(display(), window, &windowName_);
+  char* windowName = nullptr;
+  const Status nameStatus = XFetchName(display(), window, &windowName);
   if (nameStatus == 0) {
     fprintf(stderr, kWindowNameError, window);
   }
-  const Status hostStatus = XGetWMClientMachine(display(), window, &hostName_);
+  if (windowName) {
+    attributes->title = windowName;
+    XFree(windowName);
+  }
+  XTextProperty hostName = {};
+  const Status hostStatus = XGetWMClientMachine(display(), window, &hostName);
   if (hostStatus == 0) {
     fprintf(stderr, kUnknownClientNameError, window);
   }
+  if (hostName.value) {
+    attributes->host = reinterpret_cast<const char*>(hostName.value);
+    XFree(hostName.value);
+  }
   // First try to get the _NET_WM_ICON
-  unsigned long nitems;
-  unsigned long bytesafter;
-  unsigned char* result;
-  int format;
-  Atom type;
-  const Atom net_wm_icon = XInternAtom(display(), "_NET_WM_ICON", False);
-  XGetWindowProperty(display(), window, net_wm_icon, 0, 1, 0, XA_CARDINAL,
-                     &type, &format, &nitems, &bytesafter,  &result);
-  if (result) {
-    const int icon_width = *reinterpret_cast<int*>(result);
-    XFree(result);
-    XGetWindowProperty(display(), window, net_wm_icon, 1, 1, 0, XA_CARDINAL,
-                       &type, &format,  &nitems, &bytesafter, &result);
-    if (result) {
-      const int icon_height = *reinterpret_cast<int*>(result);
-      XFree(result);
-      const int icon_size = icon_width * icon_height;
-      XGetWindowProperty(display(), window, net_wm_icon, 2, icon_size, 0, XA_CARDINAL,
-                         &type, &format,  &nitems, &bytesafter, &result);
-      if (result) {
-        image_proxy_.reset(new RawImageProxy(icon_width, icon_height, result));
-        XFree(result);
-      }
+  XlibCardinalReader reader(display(), window, KnownAtom(kNetWmIconAtom));
+  std::vector<uint32_t> chunk;
+  size_t total_length = 0;
+  if (reader.Read(0, kNetWmIconChunkLength, &chunk, &total_length) && !chunk.empty()) {
+    attributes->icon.reset(ReadNetWmIcon(chunk.data(), chunk.size(), total_length, iconSize_,
+                                         &reader));
+    if (attributes->icon) {
+      return;
     }
-    return;
   }
   // Fallback to old-school X11 icons.
-  wmHints_ = XGetWMHints(display(), window);
+  XWMHints* wmHints = XGetWMHints(display(), window);
   Colormap color_map = DefaultColormap(display(), DefaultScreen(display()));
-  if (wmHints_) {
+  if (wmHints) {
     // Icon Window
-    if (wmHints_->flags & IconWindowHint) {
-      XImage* const win_image = GetImage(display(), wmHints_->icon_window);
+    if (wmHints->flags & IconWindowHint) {
+      DrawableGeometry geometry = {};
+      XImage* win_image = nullptr;
+      if (GetDrawableGeometry(display(), wmHints->icon_window, &geometry)) {
+        attributes->icon.reset(ServerScaledIcon(wmHints->icon_window, None, geometry.width,
+                                                geometry.height, geometry.depth));
+        if (attributes->icon) {
+          XFree(wmHints);
+          return;
+        }
+        win_image = GetImage(display(), wmHints->icon_window, geometry.width, geometry.height,
+                             geometry.depth, shm_.get());
+      }
       if (win_image) {
-        image_proxy_.reset(new XImageProxy(win_image, nullptr, display(), color_map));
+        attributes->icon.reset(new XImageProxy(win_image, nullptr, display(), color_map,
+                                               colormaps_.get()));
+        XFree(wmHints);
         return;
       } else {
         fprintf(stderr, "Failed to build XImage for window icon.\n");
       }
     }
     // Icon
-    if (wmHints_->flags & IconPixmapHint) {
-      XImage* const pixmap = GetImage(display(), wmHints_->icon_pixmap);
+    if (wmHints->flags & IconPixmapHint) {
+      const Pixmap icon_mask = (wmHints->flags & IconMaskHint) ? wmHints->icon_mask : None;
+      DrawableGeometry geometry = {};
+      XImage* pixmap = nullptr;
+      if (GetDrawableGeometry(display(), wmHints->icon_pixmap, &geometry)) {
+        attributes->icon.reset(ServerScaledIcon(wmHints->icon_pixmap, icon_mask, geometry.width,
+                                                geometry.height, geometry.depth));
+        if (!attributes->icon) {
+          pixmap = GetImage(display(), wmHints->icon_pixmap, geometry.width, geometry.height,
+                            geometry.depth, shm_.get());
+        }
+      }
       if (pixmap) {
         XImage* mask = nullptr;
-        if (wmHints_->flags & IconMaskHint) {
-          mask = GetImage(display(), wmHints_->icon_mask);
+        if (icon_mask != None) {
+          mask = GetImage(display(), icon_mask, shm_.get());
         }
-        image_proxy_.reset(new XImageProxy(pixmap, mask, display(), color_map));
+        attributes->icon.reset(new XImageProxy(pixmap, mask, display(), color_map,
+                                               colormaps_.get()));
       }
     }
-  } // Has wmHints_
+    XFree(wmHints);
+  } // Has wmHints
 } // GetAttributesFromWindow
 
-Display* BellEventImpl::display() {
-  return data_->display();
-}
-
-Window BellEventImpl::window() {
-  return event_.bell.window;
-}
-
-ImageProxy* BellEventImpl::imageProxy() {
-  return image_proxy_.get();
+const ImageProxy* BellEventImpl::imageProxy() const {
+  return attributes_.icon.get();
 }
 
 // Name is an X11 atom, and therefore in iso-latin encoding
 std::string BellEventImpl::name() const {
-  if (name_) {
-    return name_;
-  } else {
-    return kEmptyString;
-  }
+  return name_;
 }
 
 std::string BellEventImpl::windowName() const {
-  if (windowName_) {
-    return windowName_;
-  }
-  return kEmptyString;
+  return attributes_.title;
 }
 
 std::string BellEventImpl::hostName() const {
-  const char* const hostname = reinterpret_cast<const char*>(hostName_.value);
-  if (hostname) {
-    return hostname;
-  }
-  return kEmptyString;
+  return attributes_.host;
+}
+
+std::string BellEventImpl::displayName() const {
+  return displayName_;
+}
+
+unsigned long BellEventImpl::window() const {
+  return event_.window;
 }
 
 int BellEventImpl::pitch() const {
-  return event_.bell.pitch;
+  return event_.pitch;
 }
 
 int BellEventImpl::percent() const {
-  return event_.bell.percent;
+  return event_.percent;
 }
 
 int BellEventImpl::duration() const {
-  return event_.bell.duration;
+  return event_.duration;
 }
 
 int BellEventImpl::bellClass() const {
-  return event_.bell.bell_class;
+  return event_.bell_class;
 }
 
 int BellEventImpl::bellId() const {
-  return event_.bell.bell_id;
+  return event_.bell_id;
 }
 
 bool BellEventImpl::eventOnly() const {
-  return event_.bell.event_only;
+  return event_.event_only;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Event loop
+// ─────────────────────────────────────────────────────────────────────────────
+
+void X11DisplayDataImpl::HandleEvent(const XEvent& event) {
+  switch (event.type) {
+    case PropertyNotify: {
+      const Atom atom = event.xproperty.atom;
+      if (atom == XA_WM_NAME || atom == XA_WM_CLIENT_MACHINE || atom == XA_WM_HINTS ||
+          atom == KnownAtom(kNetWmIconAtom)) {
+        windowCache_.Invalidate(event.xproperty.window);
+      }
+      break;
+    }
+    case DestroyNotify:
+      windowCache_.Invalidate(event.xdestroywindow.window);
+      break;
+    case ColormapNotify:
+      colormaps_->Invalidate(event.xcolormap.colormap);
+      break;
+    default:
+      break;
+  }
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Window attribute cache. Cached windows are watched for property changes and
+// destruction, so that a repeated bell needs no X request at all.
+// ─────────────────────────────────────────────────────────────────────────────
+
+WindowAttributeCache::WindowAttributeCache(size_t capacity)
+: capacity_(capacity), budget_(nullptr) {}
+
+WindowAttributeCache::~WindowAttributeCache() {
+  SetBudget(nullptr);
+}
+
+void WindowAttributeCache::SetBudget(CacheBudget* budget) {
+  while (!entries_.empty()) {
+    Erase(std::prev(entries_.end()));
+  }
+  if (budget_ != nullptr) {
+    budget_->Unregister(this);
+  }
+  budget_ = budget;
+  if (budget_ != nullptr) {
+    budget_->Register(this);
+  }
+}
+
+void WindowAttributeCache::Erase(EntryList::iterator entry) {
+  if (budget_ != nullptr) {
+    budget_->Release(entry->bytes);
+  }
+  index_.erase(entry->window);
+  entries_.erase(entry);
+}
+
+bool WindowAttributeCache::Lookup(Window window, WindowAttributes* attributes) {
+  std::unordered_map<Window, EntryList::iterator>::iterator it = index_.find(window);
+  if (it == index_.end()) {
+    return false;
+  }
+  entries_.splice(entries_.begin(), entries_, it->second);
+  if (budget_ != nullptr) {
+    it->second->used = budget_->Tick();
+  }
+  *attributes = it->second->attributes;
+  return true;
+}
+
+bool WindowAttributeCache::Insert(Window window, const WindowAttributes& attributes) {
+  Invalidate(window);
+  if (entries_.size() >= capacity_ && !entries_.empty()) {
+    EvictOldest();
+  }
+  Entry entry = { window, attributes, 0, 0 };
+  if (budget_ != nullptr) {
+    if (attributes.icon) {
+      entry.bytes = size_t(attributes.icon->width()) * attributes.icon->height() * 4;
+    }
+    // May evict entries of this cache too.
+    if (!budget_->Charge(entry.bytes)) {
+      dropped_.push_back(window);
+      return false;
+    }
+    entry.used = budget_->Tick();
+  }
+  entries_.push_front(entry);
+  index_[window] = entries_.begin();
+  return true;
+}
+
+bool WindowAttributeCache::Invalidate(Window window) {
+  std::unordered_map<Window, EntryList::iterator>::iterator it = index_.find(window);
+  if (it == index_.end()) {
+    return false;
+  }
+  Erase(it->second);
+  return true;
+}
+
+bool WindowAttributeCache::OldestUse(uint64_t* tick) const {
+  if (entries_.empty()) {
+    return false;
+  }
+  *tick = entries_.back().used;
+  return true;
+}
+
+void WindowAttributeCache::EvictOldest() {
+  // Also called when another cache needs room, the window is only deselected
+  // by the next TakeDropped.
+  dropped_.push_back(entries_.back().window);
+  Erase(std::prev(entries_.end()));
+}
+
+void WindowAttributeCache::TakeDropped(std::vector<Window>* windows) {
+  for (size_t i = 0; i < dropped_.size(); ++i) {
+    if (index_.count(dropped_[i]) == 0) {
+      windows->push_back(dropped_[i]);
+    }
+  }
+  dropped_.clear();
+}
+
+void X11DisplayDataImpl::GetCachedAttributes(Window window, WindowAttributes* attributes) {
+  if (windowCache_.Lookup(window, attributes)) {
+    return;
+  }
+  std::vector<WindowAttributes> fetched;
+  FetchAndCacheAttributes(std::vector<Window>(1, window), &fetched);
+  *attributes = fetched[0];
+}
+
+void X11DisplayDataImpl::FetchAndCacheAttributes(const std::vector<Window>& windows,
+                                                 std::vector<WindowAttributes>* attributes) {
+  // Select before fetching, so that no change between the two is missed.
+  for (size_t i = 0; i < windows.size(); ++i) {
+    XSelectInput(display(), windows[i], kWatchedWindowMask);
+  }
+  attributes->resize(windows.size());
+  GetAttributesFromWindows(windows, attributes);
+  for (size_t i = 0; i < windows.size(); ++i) {
+    windowCache_.Insert(windows[i], (*attributes)[i]);
+  }
+  // Windows that are not cached, including those refused just now, are no
+  // longer watched.
+  std::vector<Window> dropped;
+  windowCache_.TakeDropped(&dropped);
+  const Window root = RootWindow(display(), DefaultScreen(display()));
+  for (size_t i = 0; i < dropped.size(); ++i) {
+    XSelectInput(display(), dropped[i], dropped[i] == root ? kRootWindowMask : NoEventMask);
+  }
+}
+
+void X11DisplayDataImpl::GetAttributesFromWindows(const std::vector<Window>& windows,
+                                                  std::vector<WindowAttributes>* attributes) {
+  for (size_t i = 0; i < windows.size(); ++i) {
+    GetAttributesFromWindow(windows[i], &(*attributes)[i]);
+  }
+}
+
+Window X11DisplayDataImpl::AttributeWindow(const XkbBellNotifyEvent& event) {
+  if (event.window) {
+    return event.window;
+  }
+  return RootWindow(display(), DefaultScreen(display()));
+}
+
+bool X11DisplayDataImpl::PollXkbBellEvent(XkbEvent* event) {
+  // XPending flushes the output buffer and reads what is available without blocking.
+  while (connected_ && XPending(display()) > 0) {
+    XNextEvent(display(), &event->core);
+    if (event->type == xkbEventCode_ && event->any.xkb_type == XkbBellNotify) {
+      return true;
+    }
+    HandleEvent(event->core);
+  }
+  return false;
+}
+
+bool X11DisplayDataImpl::WaitForEvents(int timeout) {
+  struct pollfd descriptor = { FileDescriptor(), POLLIN, 0 };
+  if (poll(&descriptor, 1, timeout) < 0) {
+    if (errno != EINTR) {
+      perror("poll");
+    }
+    return false;
+  }
+  return true;
+}
+
+// The single event variants go through NextBellEvents, so that they share its
+// rate limiting and the handling of a lost connection.
+
+BellEvent* X11DisplayDataImpl::TryNextBellEvent() {
+  std::vector<std::unique_ptr<BellEvent> > events;
+  // Bells refused by the rate limiter are skipped.
+  while (events.empty()) {
+    if (NextBellEvents(1, &events) == 0) {
+      return nullptr;
+    }
+  }
+  return events[0].release();
 }
 
 BellEvent* X11DisplayDataImpl::NextBellEvent() {
-  return new BellEventImpl(this);
+  while (connected_) {
+    BellEvent* const event = TryNextBellEvent();
+    if (event != nullptr) {
+      return event;
+    }
+    // Signals do not stop the wait.
+    if (connected_ && !WaitForEvents(-1) && errno != EINTR) {
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+BellEvent* X11DisplayDataImpl::NextBellEvent(int timeout) {
+  const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  while (connected_) {
+    BellEvent* const event = TryNextBellEvent();
+    if (event != nullptr) {
+      return event;
+    }
+    const long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now()).count();
+    if (!connected_ || remaining <= 0) {
+      return nullptr;
+    }
+    // Interrupted by a signal, let the caller handle it.
+    if (!WaitForEvents(static_cast<int>(remaining))) {
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+size_t X11DisplayDataImpl::NextBellEvents(size_t max,
+                                          std::vector<std::unique_ptr<BellEvent> >* events) {
+  std::vector<XkbEvent> bells;
+  XkbEvent event;
+  const BellRateLimiter::Clock::time_point now = BellRateLimiter::Clock::now();
+  size_t read = 0;
+  while (read < max && PollXkbBellEvent(&event)) {
+    ++read;
+    // Limited bells are dropped before their window is looked at.
+    if (limiter_ == nullptr ||
+        limiter_->AdmitBell(displayName_, event.bell.window, atoms_->Name(event.bell.name), now)) {
+      bells.push_back(event);
+    }
+  }
+  // Bells read when the connection is lost go with the display.
+  if (!connected_) {
+    return read;
+  }
+  // Windows of the batch that are not cached, each fetched once.
+  std::vector<Window> windows;
+  std::unordered_map<Window, size_t> fetched_index;
+  for (size_t i = 0; i < bells.size(); ++i) {
+    const Window window = AttributeWindow(bells[i].bell);
+    WindowAttributes unused;
+    if (fetched_index.count(window) == 0 && !windowCache_.Lookup(window, &unused)) {
+      fetched_index[window] = windows.size();
+      windows.push_back(window);
+    }
+  }
+  std::vector<WindowAttributes> fetched;
+  FetchAndCacheAttributes(windows, &fetched);
+  if (!connected_) {
+    return read;
+  }
+  for (size_t i = 0; i < bells.size(); ++i) {
+    const Window window = AttributeWindow(bells[i].bell);
+    // The batch may hold more windows than the cache, so look at fetched first.
+    WindowAttributes attributes;
+    std::unordered_map<Window, size_t>::const_iterator it = fetched_index.find(window);
+    if (it != fetched_index.end()) {
+      attributes = fetched[it->second];
+    } else {
+      GetCachedAttributes(window, &attributes);
+    }
+    std::unique_ptr<BellEvent> bell(
+        new BellEventImpl(bells[i].bell, atoms_->Name(bells[i].bell.name), attributes,
+                          displayName_));
+    if (limiter_ == nullptr || limiter_->AdmitHost(*bell, now)) {
+      events->push_back(std::move(bell));
+    }
+  }
+  return read;
+}
+
+int X11DisplayDataImpl::FileDescriptor() const {
+  return ConnectionNumber(display_);
+}
+
+bool X11DisplayDataImpl::HasQueuedEvents() {
+  return connected_ && XEventsQueued(display(), QueuedAlready) > 0;
 }
 
@@ -10,8 +10,29 @@
 
 #ifndef XKBGROWL_X11_UTIL
 #define XKBGROWL_X11_UTIL
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
+// Size, in pixels, of the icons attached to notifications.
+const int kNotificationIconSize = 128;
+
+// Byte layout of 32 bit pixels.
+enum PixelFormat {
+  kPixelFormatARGB,  // A, R, G, B: the layout written by provideARGB.
+  kPixelFormatBGRA,  // B, G, R, A: 0xAARRGGBB values on little endian hosts.
+  kPixelFormatXRGB,  // As ARGB, but the first byte is padding, pixels are opaque.
+  kPixelFormatBGRX   // As BGRA, but the last byte is padding, pixels are opaque.
+};
+
+// Read-only view of pixels kept in memory by an image proxy.
+struct PixelView {
+  const unsigned char* data;  // First pixel of the first row.
+  size_t stride;              // Distance between rows, in bytes.
+  PixelFormat format;
+};
 
 // ─────────────────────────────────────────────────────────────────────────────
 // Wrapper interface that holds the various elements of a X11 bell event.
@@ -19,18 +40,28 @@
 
 class ImageProxy {
  public:
-  ImageProxy(int width, int height) : width_(width), height_(height) {}
+  ImageProxy(int width, int height);
   virtual ~ImageProxy() {}
   int height() const { return height_; }
   int width() const { return width_; }
+  // Distinct for every proxy built. Proxies are never modified and a window
+  // gets a new one each time its icon properties change, so this stands for
+  // the serial of the icon pixmap or property the pixels were read from.
+  uint64_t generation() const { return generation_; }
   virtual void provideARGB(int x, int y, int width, int height, void* data) const = 0;
   void provideARGB(void *data) const { provideARGB(0, 0, width_, height_, data); }
+  // Fills view and returns true if the pixels are held in memory in one of
+  // the PixelFormat layouts, so that no conversion is needed to read them.
+  // The view is valid as long as the proxy.
+  virtual bool pixelView(PixelView* /*view*/) const { return false; }
  protected:
   const int width_;
   const int height_;
-  
+  const uint64_t generation_;
 };
 
+// Events are fully resolved when they are returned: their accessors never
+// talk to the X11 server, so they can be used from another thread.
 class BellEvent {
  public:
   BellEvent();
@@ -38,15 +69,29 @@ class BellEvent {
   virtual std::string name() const = 0;        // name of the event iso-latin1
   virtual std::string windowName() const = 0;  // window name or empty
   virtual std::string hostName() const = 0;    // hostname where event occured
+  virtual std::string displayName() const = 0; // display the event was read from
+  virtual unsigned long window() const = 0;    // X11 window of the event, 0 if none
   virtual int pitch() const = 0;               // beep pitch
   virtual int percent() const = 0;             // beep percentage -100 - 100
   virtual int duration() const = 0;            // beep duration
   virtual int bellClass() const = 0;           // beep class
   virtual int bellId() const = 0;              // beep id
   virtual bool eventOnly() const = 0;          // is this only an event
-  virtual ImageProxy* imageProxy() = 0;
+  virtual const ImageProxy* imageProxy() const = 0;  // window icon or null
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Library used to talk to the X11 server.
+// ─────────────────────────────────────────────────────────────────────────────
+
+enum X11Backend {
+  kXlibBackend,  // Xlib, one round trip per request.
+  kXcbBackend,   // XCB, attribute requests for a bell are pipelined.
 };
 
+class BellRateLimiter;
+class CacheBudget;
+
 // ─────────────────────────────────────────────────────────────────────────────
 // Wrapper interface for the X11 subsystem
 // We hide most of the X11 internals to avoid names conflicts with the Mac OS
@@ -60,10 +105,32 @@ class X11DisplayData {
   explicit X11DisplayData(const std::string& programName, const std::string& displayName);
  public:
   /// Factory method, constructs a concrete instance, caller owns the instance.
-  static X11DisplayData* GetDisplayData(const std::string& programName, const std::string& displayName);
+  /// Returns null, after printing why, if the display cannot be opened.
+  static X11DisplayData* GetDisplayData(const std::string& programName, const std::string& displayName,
+                                        X11Backend backend = kXlibBackend);
   virtual ~X11DisplayData();
-  virtual BellEvent* NextBellEvent() = 0;            // block until next event, event is owned by caller.
+  // The single event variants apply the rate limiter like NextBellEvents and
+  // return null once the connection is lost. The event is owned by the caller.
+  virtual BellEvent* NextBellEvent() = 0;            // block until next event.
+  virtual BellEvent* NextBellEvent(int timeout) = 0; // wait at most timeout ms, null if no event.
+  virtual BellEvent* TryNextBellEvent() = 0;         // next queued event, null if none, never blocks.
+  // Appends at most max queued events to events, never blocks. The window
+  // attributes of the whole batch are fetched together. Returns the number of
+  // bells read, including those refused by the rate limiter; when it is zero
+  // FileDescriptor() can be polled.
+  virtual size_t NextBellEvents(size_t max, std::vector<std::unique_ptr<BellEvent> >* events) = 0;
+  virtual int FileDescriptor() const = 0;            // connection, readable when events may be pending.
+  virtual bool HasQueuedEvents() = 0;                // events already read, FileDescriptor won't signal them.
   virtual void SendBellEvent(const std::string& name) = 0;  // send a new bell event
+  virtual void SetIconSize(int size) = 0;                   // preferred icon size, in pixels
+  virtual void SetServerScaling(bool enabled) = 0;          // shrink large icons with XRender
+  // Bells read by NextBellEvents must pass limiter, not owned, null for none.
+  virtual void SetRateLimiter(BellRateLimiter* limiter) = 0;
+  // Caches are charged to budget, not owned, null for none.
+  virtual void SetCacheBudget(CacheBudget* budget) = 0;
+  // False once the connection to the server is lost, while reading events or
+  // in HasQueuedEvents. The display is then of no further use.
+  virtual bool connected() const = 0;
 };
 
 #endif
@@ -0,0 +1,423 @@
+/*
+ *  xcbDisplay.cpp
+ *  xkbgrowl
+ *
+ *  Created by Matthias Wiesmann on 16.10.26.
+ *  Copyright 2009 Matthias Wiesmann. All rights reserved.
+ *  The source code of this program is licensed under the Apache 2.0 license.
+ *  For more information, see http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  XCB backend for the display wrapper. XKB setup and the event queue stay
+ *  with Xlib, but all the requests needed to describe the window of a bell are
+ *  sent as XCB cookies in a single flight, and the replies collected after.
+ *  Over a forwarded connection this costs one round trip instead of seven.
+ *  On local displays, deep images are read through the MIT-SHM segment of
+ *  the Xlib backend.
+ */
+
+#include "x11Impl.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
+#include <X11/Xutil.h>
+#include <xcb/xcb.h>
+#include <xcb/shm.h>
+
+// Maximum length, in 32 bit units, read for text properties.
+const uint32_t kMaxTextLength = 1024;
+// Number of 32 bit fields in the WM_HINTS property.
+const uint32_t kWMHintsLength = 9;
+
+const char kXcbImageError[] = "xcb_get_image failed for drawable %lx\n";
+
+// Layout of the WM_HINTS property, see ICCCM section 4.1.2.4.
+struct WMHintsProperty {
+  uint32_t flags;
+  uint32_t input;
+  uint32_t initial_state;
+  uint32_t icon_pixmap;
+  uint32_t icon_window;
+  int32_t icon_x;
+  int32_t icon_y;
+  uint32_t icon_mask;
+  uint32_t window_group;
+};
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Reads a CARDINAL property with a synchronous xcb_get_property.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class XcbCardinalReader : public CardinalReader {
+public:
+  XcbCardinalReader(xcb_connection_t* connection, xcb_window_t window, xcb_atom_t property)
+  : connection_(connection), window_(window), property_(property) {}
+  virtual bool Read(size_t offset, size_t length, std::vector<uint32_t>* values);
+private:
+  xcb_connection_t* const connection_;
+  const xcb_window_t window_;
+  const xcb_atom_t property_;
+};
+
+bool XcbCardinalReader::Read(size_t offset, size_t length, std::vector<uint32_t>* values) {
+  xcb_get_property_cookie_t cookie = xcb_get_property(connection_, 0, window_, property_,
+                                                      XCB_ATOM_CARDINAL, offset, length);
+  xcb_get_property_reply_t* reply = xcb_get_property_reply(connection_, cookie, nullptr);
+  if (reply == nullptr) {
+    return false;
+  }
+  const bool valid = reply->type == XCB_ATOM_CARDINAL && reply->format == 32;
+  if (valid) {
+    const uint32_t* const data = static_cast<const uint32_t*>(xcb_get_property_value(reply));
+    values->assign(data, data + reply->value_len);
+  }
+  free(reply);
+  return valid;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// XCB implementation of the X11 display wrapper.
+// ─────────────────────────────────────────────────────────────────────────────
+
+class X11DisplayDataXcb : public X11DisplayDataImpl {
+public:
+  X11DisplayDataXcb(const std::string& programName, const std::string& displayName);
+  virtual ~X11DisplayDataXcb();
+  virtual bool Open();
+protected:
+  // Cookies for the requests describing one window.
+  struct PendingAttributes {
+    xcb_get_property_cookie_t name;
+    xcb_get_property_cookie_t host;
+    xcb_get_property_cookie_t icon;
+    xcb_get_property_cookie_t hints;
+  };
+
+  virtual void GetAttributesFromWindow(Window window, WindowAttributes* attributes);
+  // Sends the requests for all windows before collecting any reply.
+  virtual void GetAttributesFromWindows(const std::vector<Window>& windows,
+                                        std::vector<WindowAttributes>* attributes);
+  // Sends all the requests for window, does not wait.
+  PendingAttributes RequestAttributes(Window window);
+  // Waits for the replies of RequestAttributes.
+  void CollectAttributes(Window window, const PendingAttributes& pending,
+                         WindowAttributes* attributes);
+  // A drawable named by WM_HINTS and its geometry.
+  struct HintDrawable {
+    xcb_drawable_t drawable;  // XCB_NONE if absent or unreadable.
+    uint16_t width;
+    uint16_t height;
+    uint8_t depth;
+  };
+
+  // Cookie for the image of one drawable.
+  struct PendingImage {
+    bool shared;                     // Read into the segment of shm_…
+    xcb_shm_get_image_cookie_t shm;  // … by this request…
+    size_t size;                     // … that writes this many bytes.
+    xcb_get_image_cookie_t image;    // Read through the socket otherwise.
+  };
+
+  // Fetches the icon named by WM_HINTS, only reading the images it needs.
+  void GetImagesFromHints(const WMHintsProperty& hints, WindowAttributes* attributes);
+  // Sends the GetImage request for drawable, does not wait. Deep images are
+  // read through shared memory if use_shm is set; the segment holds a single
+  // image, so at most one request in flight can use it.
+  PendingImage RequestImage(const HintDrawable& drawable, bool use_shm);
+  // Waits for the reply of RequestImage, null if it failed.
+  XImage* CollectImage(const HintDrawable& drawable, const PendingImage& pending);
+  // Copy of length bytes of image data, in the format used by RequestImage.
+  XImage* MakeImage(const void* data, size_t length, uint8_t depth, uint16_t width,
+                    uint16_t height);
+
+  xcb_connection_t* connection_;  // owned by display_
+};
+
+X11DisplayDataImpl* NewXcbDisplayData(const std::string& programName,
+                                      const std::string& displayName) {
+  return new X11DisplayDataXcb(programName, displayName);
+}
+
+X11DisplayDataXcb::X11DisplayDataXcb(const std::string& programName,
+                                     const std::string& displayName)
+: X11DisplayDataImpl(programName, displayName), connection_(nullptr) {}
+
+bool X11DisplayDataXcb::Open() {
+  if (!X11DisplayDataImpl::Open()) {
+    return false;
+  }
+  connection_ = XGetXCBConnection(display());
+  assert(connection_ != nullptr);
+  return true;
+}
+
+X11DisplayDataXcb::~X11DisplayDataXcb() {}
+
+// Copies a text property reply into result, frees the reply.
+static bool TakeTextProperty(xcb_get_property_reply_t* reply, std::string* result) {
+  if (reply == nullptr) {
+    return false;
+  }
+  const bool found = reply->type != XCB_NONE && reply->format == 8;
+  if (found) {
+    const char* const value = static_cast<const char*>(xcb_get_property_value(reply));
+    const int length = xcb_get_property_value_length(reply);
+    // Text properties may contain several nul separated strings, keep the first.
+    result->assign(value, strnlen(value, length));
+  }
+  free(reply);
+  return found;
+}
+
+X11DisplayDataXcb::PendingAttributes X11DisplayDataXcb::RequestAttributes(Window window) {
+  PendingAttributes pending;
+  pending.name = xcb_get_property(connection_, 0, window, XCB_ATOM_WM_NAME,
+                                  XCB_ATOM_STRING, 0, kMaxTextLength);
+  pending.host = xcb_get_property(connection_, 0, window, XCB_ATOM_WM_CLIENT_MACHINE,
+                                  XCB_GET_PROPERTY_TYPE_ANY, 0, kMaxTextLength);
+  pending.icon = xcb_get_property(connection_, 0, window, KnownAtom(kNetWmIconAtom),
+                                  XCB_ATOM_CARDINAL, 0, kNetWmIconChunkLength);
+  pending.hints = xcb_get_property(connection_, 0, window, XCB_ATOM_WM_HINTS,
+                                   XCB_ATOM_WM_HINTS, 0, kWMHintsLength);
+  // Waiting for the first reply flushes the requests.
+  return pending;
+}
+
+void X11DisplayDataXcb::CollectAttributes(Window window, const PendingAttributes& pending,
+                                          WindowAttributes* attributes) {
+  if (!TakeTextProperty(xcb_get_property_reply(connection_, pending.name, nullptr),
+                        &attributes->title)) {
+    fprintf(stderr, kWindowNameError, window);
+  }
+  if (!TakeTextProperty(xcb_get_property_reply(connection_, pending.host, nullptr),
+                        &attributes->host)) {
+    fprintf(stderr, kUnknownClientNameError, window);
+  }
+  // First try to get the _NET_WM_ICON
+  xcb_get_property_reply_t* icon = xcb_get_property_reply(connection_, pending.icon, nullptr);
+  if (icon != nullptr && icon->type == XCB_ATOM_CARDINAL && icon->format == 32) {
+    const uint32_t* const values = static_cast<const uint32_t*>(xcb_get_property_value(icon));
+    const size_t total_length = icon->value_len + icon->bytes_after / 4;
+    XcbCardinalReader reader(connection_, window, KnownAtom(kNetWmIconAtom));
+    attributes->icon.reset(ReadNetWmIcon(values, icon->value_len, total_length, iconSize_,
+                                         &reader));
+  }
+  xcb_get_property_reply_t* hints = xcb_get_property_reply(connection_, pending.hints, nullptr);
+  if (attributes->icon == nullptr && hints != nullptr && hints->format == 32 &&
+      hints->value_len >= kWMHintsLength) {
+    // Fallback to old-school X11 icons.
+    WMHintsProperty property;
+    memcpy(&property, xcb_get_property_value(hints), sizeof(property));
+    GetImagesFromHints(property, attributes);
+  }
+  free(icon);
+  free(hints);
+}
+
+void X11DisplayDataXcb::GetAttributesFromWindow(Window window, WindowAttributes* attributes) {
+  assert(window);
+  const PendingAttributes pending = RequestAttributes(window);
+  CollectAttributes(window, pending, attributes);
+}
+
+void X11DisplayDataXcb::GetAttributesFromWindows(const std::vector<Window>& windows,
+                                                 std::vector<WindowAttributes>* attributes) {
+  std::vector<PendingAttributes> pending;
+  pending.reserve(windows.size());
+  for (size_t i = 0; i < windows.size(); ++i) {
+    pending.push_back(RequestAttributes(windows[i]));
+  }
+  for (size_t i = 0; i < windows.size(); ++i) {
+    CollectAttributes(windows[i], pending[i], &(*attributes)[i]);
+  }
+  // XCB can see the connection break before Xlib does.
+  if (xcb_connection_has_error(connection_)) {
+    HandleConnectionLost(display(), this);
+  }
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// Old style icons, the geometry of all drawables is requested in one flight,
+// then only the images of the icon that is used.
+// ─────────────────────────────────────────────────────────────────────────────
+
+// Format of Z pixmaps of the given depth, null if the server has none.
+static const xcb_format_t* PixmapFormat(const xcb_setup_t* setup, uint8_t depth) {
+  for (xcb_format_iterator_t it = xcb_setup_pixmap_formats_iterator(setup); it.rem;
+       xcb_format_next(&it)) {
+    if (it.data->depth == depth) {
+      return it.data;
+    }
+  }
+  return nullptr;
+}
+
+XImage* X11DisplayDataXcb::MakeImage(const void* data, size_t length, uint8_t depth,
+                                     uint16_t width, uint16_t height) {
+  // XDestroyImage frees the data with free().
+  char* const copy = static_cast<char*>(malloc(length));
+  memcpy(copy, data, length);
+  const xcb_setup_t* const setup = xcb_get_setup(connection_);
+  // Bitmaps are requested as a single XY plane, padded like bitmaps.
+  const int format = depth == 1 ? XYPixmap : ZPixmap;
+  int scanline_pad = setup->bitmap_format_scanline_pad;
+  if (format == ZPixmap) {
+    const xcb_format_t* const pixmap_format = PixmapFormat(setup, depth);
+    if (pixmap_format != nullptr) {
+      scanline_pad = pixmap_format->scanline_pad;
+    }
+  }
+  Visual* const visual = DefaultVisual(display(), DefaultScreen(display()));
+  XImage* const image = XCreateImage(display(), visual, depth, format, 0, copy,
+                                     width, height, scanline_pad, length / height);
+  if (image == nullptr) {
+    free(copy);
+  }
+  return image;
+}
+
+X11DisplayDataXcb::PendingImage X11DisplayDataXcb::RequestImage(const HintDrawable& drawable,
+                                                                bool use_shm) {
+  PendingImage pending = {};
+  if (drawable.depth == 1) {
+    pending.image = xcb_get_image(connection_, XCB_IMAGE_FORMAT_XY_PIXMAP, drawable.drawable,
+                                  0, 0, drawable.width, drawable.height, 1);
+    return pending;
+  }
+  const xcb_format_t* const format =
+      use_shm && shm_ ? PixmapFormat(xcb_get_setup(connection_), drawable.depth) : nullptr;
+  if (format != nullptr) {
+    const size_t line_bits = size_t(drawable.width) * format->bits_per_pixel;
+    const size_t pad = format->scanline_pad;
+    pending.size = (line_bits + pad - 1) / pad * pad / 8 * drawable.height;
+    const ShmSeg segment = shm_->AcquireSegment(pending.size);
+    if (segment != 0) {
+      pending.shared = true;
+      pending.shm = xcb_shm_get_image(connection_, drawable.drawable, 0, 0, drawable.width,
+                                      drawable.height, ~0U, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                      segment, 0);
+      return pending;
+    }
+  }
+  pending.image = xcb_get_image(connection_, XCB_IMAGE_FORMAT_Z_PIXMAP, drawable.drawable, 0, 0,
+                                drawable.width, drawable.height, ~0U);
+  return pending;
+}
+
+XImage* X11DisplayDataXcb::CollectImage(const HintDrawable& drawable,
+                                        const PendingImage& pending) {
+  if (pending.shared) {
+    xcb_generic_error_t* error = nullptr;
+    xcb_shm_get_image_reply_t* reply = xcb_shm_get_image_reply(connection_, pending.shm, &error);
+    free(error);
+    XImage* image = nullptr;
+    if (reply != nullptr && reply->size >= pending.size) {
+      image = MakeImage(shm_->data(), pending.size, reply->depth, drawable.width,
+                        drawable.height);
+    }
+    free(reply);
+    if (image) {
+      return image;
+    }
+    // As with Xlib, a failed shared capture is retried through the socket.
+    return CollectImage(drawable, RequestImage(drawable, false));
+  }
+  // xcb_get_image does not work for windows that are not somehow mapped.
+  xcb_get_image_reply_t* reply = xcb_get_image_reply(connection_, pending.image, nullptr);
+  if (reply == nullptr) {
+    fprintf(stderr, kXcbImageError, static_cast<unsigned long>(drawable.drawable));
+    return nullptr;
+  }
+  XImage* const image = MakeImage(xcb_get_image_data(reply), xcb_get_image_data_length(reply),
+                                  reply->depth, drawable.width, drawable.height);
+  free(reply);
+  return image;
+}
+
+void X11DisplayDataXcb::GetImagesFromHints(const WMHintsProperty& hints,
+                                           WindowAttributes* attributes) {
+  enum { kIconWindow, kIconPixmap, kIconMask, kNumDrawables };
+  HintDrawable drawables[kNumDrawables] = {};
+  if (hints.flags & IconWindowHint) {
+    drawables[kIconWindow].drawable = hints.icon_window;
+  }
+  if (hints.flags & IconPixmapHint) {
+    drawables[kIconPixmap].drawable = hints.icon_pixmap;
+    if (hints.flags & IconMaskHint) {
+      drawables[kIconMask].drawable = hints.icon_mask;
+    }
+  }
+  xcb_get_geometry_cookie_t geometry_cookies[kNumDrawables];
+  for (int i = 0; i < kNumDrawables; ++i) {
+    if (drawables[i].drawable != XCB_NONE) {
+      geometry_cookies[i] = xcb_get_geometry(connection_, drawables[i].drawable);
+    }
+  }
+  for (int i = 0; i < kNumDrawables; ++i) {
+    if (drawables[i].drawable == XCB_NONE) {
+      continue;
+    }
+    xcb_get_geometry_reply_t* geometry =
+        xcb_get_geometry_reply(connection_, geometry_cookies[i], nullptr);
+    if (geometry == nullptr || geometry->width == 0 || geometry->height == 0) {
+      drawables[i].drawable = XCB_NONE;
+    } else {
+      drawables[i].width = geometry->width;
+      drawables[i].height = geometry->height;
+      drawables[i].depth = geometry->depth;
+    }
+    free(geometry);
+  }
+  // Only the image that is used is requested: the icon window if there is
+  // one, otherwise, or if it cannot be read, the pixmap and its mask.
+  const Colormap color_map = DefaultColormap(display(), DefaultScreen(display()));
+  const HintDrawable& window = drawables[kIconWindow];
+  if (window.drawable != XCB_NONE) {
+    // Large icons are scaled by the server; if it fails they are fetched as usual.
+    if (render_ && render_->Applies(window.width, window.height, window.depth, iconSize_)) {
+      attributes->icon.reset(ServerScaledIcon(window.drawable, None, window.width,
+                                              window.height, window.depth));
+      if (attributes->icon) {
+        return;
+      }
+    }
+    XImage* const image = CollectImage(window, RequestImage(window, true));
+    if (image) {
+      attributes->icon.reset(new XImageProxy(image, nullptr, display(), color_map,
+                                             colormaps_.get()));
+      return;
+    }
+  }
+  const HintDrawable& pixmap = drawables[kIconPixmap];
+  const HintDrawable& mask = drawables[kIconMask];
+  if (pixmap.drawable == XCB_NONE) {
+    return;
+  }
+  if (render_ && render_->Applies(pixmap.width, pixmap.height, pixmap.depth, iconSize_)) {
+    // The server applies the mask when it scales the pixmap.
+    attributes->icon.reset(ServerScaledIcon(pixmap.drawable, mask.drawable, pixmap.width,
+                                            pixmap.height, pixmap.depth));
+    if (attributes->icon) {
+      return;
+    }
+  }
+  // The pixmap and its mask are fetched in one flight, only the pixmap can
+  // use the shared segment.
+  const PendingImage pixmap_pending = RequestImage(pixmap, true);
+  PendingImage mask_pending = {};
+  if (mask.drawable != XCB_NONE) {
+    mask_pending = RequestImage(mask, false);
+  }
+  XImage* const pixmap_image = CollectImage(pixmap, pixmap_pending);
+  XImage* const mask_image =
+      mask.drawable != XCB_NONE ? CollectImage(mask, mask_pending) : nullptr;
+  if (pixmap_image) {
+    attributes->icon.reset(new XImageProxy(pixmap_image, mask_image, display(), color_map,
+                                           colormaps_.get()));
+  } else if (mask_image) {
+    XDestroyImage(mask_image);
+  }
+}
@@ -28,25 +28,52 @@
 
 #import <Foundation/Foundation.h>
 #import <AppKit/AppKit.h>
-#import <QuartzCore/CoreImage.h>
 #include <sysexits.h>
-#include <signal.h>
 #include <getopt.h>
 #include <sandbox.h>
 #include <memory>
-#include <unistd.h>
+#include <string>
+#include <vector>
 
+#include "bellDaemon.h"
+#include "displayMultiplexer.h"
+#include "iconEncoder.h"
+#include "iconResampler.h"
+#include "notificationSink.h"
 #include "x11Util.h"
 
 const char kNoGrowlError[] = "Could not connect to Growl\n";
+const char kNoDisplayError[] = "Could not open any display\n";
+const char kAllDisplaysLostError[] = "Lost the connection to every display\n";
 const char kNoSandboxError[] = "Could not initialise sandbox: %s";
 const char kGrowlVersionMessage[] = "Connected to Growl %s.\n";
-const char KNoHostname[] = "Could not retrieve hostname";
-const char kUsage[] = "X11 Keyboard bell to Growl notification bridge.\nUsage: %s [-display DISPLAY]\n";
+const char kUsage[] = "X11 Keyboard bell to Growl notification bridge.\nUsage: %s [-display DISPLAY]... [-backend xlib|xcb]\n       [-coalesce MS] [-coalesce-limit COUNT]\n       [-queue-size COUNT] [-overload block|drop-oldest|drop-newest|coalesce]\n       [-priority-aging MS]\n       [-limit-window RATE[:BURST]] [-limit-name RATE[:BURST]]\n       [-limit-host RATE[:BURST]] [-limit-digest MS]\n       [-filter lanczos|box] [-server-scale]\n       [-sink growl|dbus|json[:FILE]|socket:PATH]... [-icon-format png|qoi]\n       [-sink-queue COUNT] [-sink-deadline MS]\n";
 const char kDisplayEnv[] = "DISPLAY";
 const char kDisplayArg[] = "display";
+const char kBackendArg[] = "backend";
+const char kCoalesceArg[] = "coalesce";
+const char kCoalesceLimitArg[] = "coalesce-limit";
+const char kQueueSizeArg[] = "queue-size";
+const char kOverloadArg[] = "overload";
+const char kPriorityAgingArg[] = "priority-aging";
+const char kLimitWindowArg[] = "limit-window";
+const char kLimitNameArg[] = "limit-name";
+const char kLimitHostArg[] = "limit-host";
+const char kLimitDigestArg[] = "limit-digest";
+const char kFilterArg[] = "filter";
+const char kLanczosFilterName[] = "lanczos";
+const char kBoxFilterName[] = "box";
+const char kServerScaleArg[] = "server-scale";
+const char kSinkArg[] = "sink";
+const char kGrowlSinkName[] = "growl";
+const char kIconFormatArg[] = "icon-format";
+const char kSinkQueueArg[] = "sink-queue";
+const char kSinkDeadlineArg[] = "sink-deadline";
+const char kXlibBackendName[] = "xlib";
+const char kXcbBackendName[] = "xcb";
 const char kVersionFormat[] = "xkbgrowl – built on %s\n";
-const size_t kRGBABytes = 4;
+// Memory used to keep converted notification icons.
+const size_t kIconCacheBudget = 4 * 1024 * 1024;
 
 // ─────────────────────────────────────────────────────────────────────────────
 // Growl Notification interface.
@@ -73,6 +100,8 @@ id<GrowlNotificationProtocol> getGrowlProxy() {
     fprintf(stderr, kNoGrowlError);
     exit(EX_UNAVAILABLE);
   }
+  // Notifications are posted from the Growl sink worker thread.
+  [connection enableMultipleThreads];
   [theProxy setProtocolForProxy:@protocol(GrowlNotificationProtocol)];
   id<GrowlNotificationProtocol> growlProxy = (id)theProxy;
   NSString* version = [growlProxy growlVersion];
@@ -97,72 +126,42 @@ NSString* fromStdString(const std::string& str) {
 }
 
 // ─────────────────────────────────────────────────────────────────────────────
-// Translate a bell event into a dictionary understood by Growl
-// TODO: currently X11 icons are retreived and converted for each
-// notification, they could probably be cached.
+// Sink that translates bell events into dictionaries understood by Growl.
 // ─────────────────────────────────────────────────────────────────────────────
 
-NSDictionary* dictionaryForEvent(BellEvent* event, NSData* defaultIcon) {
-  NSMutableDictionary* dictionary = [[NSMutableDictionary alloc] init];
-  [dictionary setObject: @"Bell" forKey:  @"NotificationName"];
-  [dictionary setObject: @"XKB" forKey: @"ApplicationName"];
-  NSString* title = fromStdString(event->name());
-  [dictionary setObject: title forKey: @"NotificationTitle"];
-  NSString* description = [NSString stringWithString: title];
-  // If there is a window name, prepend it to the notification text
-  if (!event->windowName().empty()) {
-    NSString* windowName = fromStdString(event->windowName());
-    description = [NSString stringWithFormat: @"%@: %@", windowName, description];
-  }
-  if (!event->hostName().empty()) {
-    char hostname[256];
-    const int status = gethostname(&hostname[0], sizeof(hostname));
-    if (status) {
-      perror(KNoHostname);
-    }
-    const std::string& event_hostname = event->hostName();
-    if (!event_hostname.empty() && event_hostname != hostname) {
-      NSString* hostName = fromStdString(event_hostname);
-      description = [NSString stringWithFormat: @"%@: %@", hostName, description];
+class GrowlSink : public NotificationSink {
+public:
+  GrowlSink(id<GrowlNotificationProtocol> proxy, NSData* defaultIcon)
+  : proxy_(proxy), defaultIcon_(defaultIcon) {}
+  const char* name() const { return kGrowlSinkName; }
+  // Growl decodes icons with NSImage, which reads PNG but not QOI.
+  IconEncoding iconEncoding() const { return kPngEncoding; }
+  bool Post(const BellEvent& event, size_t count, const IconBlob* icon);
+private:
+  id<GrowlNotificationProtocol> proxy_;
+  NSData* defaultIcon_;  // Used for events without icon.
+};
+
+bool GrowlSink::Post(const BellEvent& event, size_t count, const IconBlob* icon) {
+  @autoreleasepool {
+    NSMutableDictionary* dictionary = [[NSMutableDictionary alloc] init];
+    [dictionary setObject: @"Bell" forKey:  @"NotificationName"];
+    [dictionary setObject: @"XKB" forKey: @"ApplicationName"];
+    [dictionary setObject: fromStdString(ToUtf8(event.name())) forKey: @"NotificationTitle"];
+    [dictionary setObject: fromStdString(ToUtf8(NotificationText(event, count)))
+                   forKey: @"NotificationDescription"];
+    // Convert volume in the [0 … 100] range to a number between 0 and 4.
+    NSNumber* priority = [NSNumber numberWithInt: (event.percent() - 50) / 25];
+    [dictionary setObject: priority forKey: @"NotificationPriority"];
+    if (icon != nullptr) {
+      NSData* icon_data = [NSData dataWithBytes: icon->data() length: icon->size()];
+      [dictionary setObject: icon_data forKey: @"NotificationIcon"];
+    } else {
+      [dictionary setObject: defaultIcon_ forKey: @"NotificationIcon"];
     }
+    [proxy_ postNotificationWithDictionary: dictionary];
   }
-  [dictionary setObject: description forKey: @"NotificationDescription"];
-  // Convert volume in the [0 … 100] range to a number between 0 and 4.
-  NSNumber* priority = [NSNumber numberWithInt: (event->percent() - 50) / 25];
-  [dictionary setObject: priority forKey: @"NotificationPriority"];
-  // If there is an icon associated with the event, convert it for Growl.
-  
-  const ImageProxy* image_proxy = event->imageProxy();
-  if (image_proxy != nullptr) {
-    // The imageProxy class does most of the heavy lifting for the conversion.
-    const size_t num_bytes = image_proxy->width() * image_proxy->height() * kRGBABytes;
-    NSMutableData* buffer = [NSMutableData dataWithLength: num_bytes];
-    image_proxy->provideARGB([buffer mutableBytes]);
-    CGSize image_size = CGSizeMake(image_proxy->width(), image_proxy->height());
-    CIImage* image = [CIImage imageWithBitmapData: buffer
-                                      bytesPerRow: image_proxy->width() * kRGBABytes
-                                             size: image_size
-                                           format: kCIFormatARGB8
-                                       colorSpace: nil];
-    CGSize originalSize = [image extent].size;
-    NSSize targetSize = NSMakeSize(128, 128);
-    const double scale = targetSize.height / static_cast<double> (originalSize.height);
-    const double ratio = originalSize.height / static_cast<double> (originalSize.height);
-    CIFilter* scale_filter = [CIFilter filterWithName:@"CILanczosScaleTransform"];
-    [scale_filter setValue: [NSNumber numberWithFloat: scale] forKey:@"inputScale"];
-    [scale_filter setValue: [NSNumber numberWithFloat: ratio] forKey:@"inputAspectRatio"];
-    [scale_filter setValue: image forKey:@"inputImage"];
-    CIImage* outputImage = [scale_filter valueForKey:@"outputImage"];
-    NSCIImageRep* repr = [NSCIImageRep imageRepWithCIImage: outputImage];
-    NSImage* resultImage = [[NSImage alloc] initWithSize: targetSize];
-    [resultImage addRepresentation: repr];
-    NSData* icon_data = [resultImage TIFFRepresentation];
-    [dictionary setObject: icon_data forKey: @"NotificationIcon"];
-  } else {
-  
-    [dictionary setObject: defaultIcon forKey: @"NotificationIcon"];
-  }
-  return dictionary;
+  return true;
 }
 
 // ─────────────────────────────────────────────────────────────────────────────
@@ -171,20 +170,144 @@ NSDictionary* dictionaryForEvent(BellEvent* event, NSData* defaultIcon) {
 
 
 static struct option longopts[] = {
-  { kDisplayArg, optional_argument, nullptr, 0},
+  { kDisplayArg, required_argument, nullptr, 'd'},
+  { kBackendArg, required_argument, nullptr, 'b'},
+  { kCoalesceArg, required_argument, nullptr, 'c'},
+  { kCoalesceLimitArg, required_argument, nullptr, 'l'},
+  { kQueueSizeArg, required_argument, nullptr, 'q'},
+  { kOverloadArg, required_argument, nullptr, 'o'},
+  { kPriorityAgingArg, required_argument, nullptr, 'a'},
+  { kLimitWindowArg, required_argument, nullptr, 'w'},
+  { kLimitNameArg, required_argument, nullptr, 'm'},
+  { kLimitHostArg, required_argument, nullptr, 'h'},
+  { kLimitDigestArg, required_argument, nullptr, 'g'},
+  { kFilterArg, required_argument, nullptr, 'f'},
+  { kServerScaleArg, no_argument, nullptr, 's'},
+  { kSinkArg, required_argument, nullptr, 'n'},
+  { kIconFormatArg, required_argument, nullptr, 'i'},
+  { kSinkQueueArg, required_argument, nullptr, 'k'},
+  { kSinkDeadlineArg, required_argument, nullptr, 'e'},
+  { nullptr, 0, nullptr, 0},
 };
 
-char display[1024];
+std::vector<std::string> displays;
+X11Backend backend = kXlibBackend;
+int coalesceWindow = kDefaultCoalesceWindow;
+size_t coalesceLimit = kDefaultCoalesceLimit;
+size_t queueCapacity = kDefaultQueueCapacity;
+OverloadPolicy overloadPolicy = kDefaultOverloadPolicy;
+int priorityAging = kDefaultPriorityAging;
+RateLimit windowLimit = { 0, 0 };
+RateLimit nameLimit = { 0, 0 };
+RateLimit hostLimit = { 0, 0 };
+int digestInterval = kDefaultDigestInterval;
+ResampleFilter iconFilter = kLanczosFilter;
+bool serverScaling = false;
+std::vector<std::string> sinkSpecs;
+IconEncoding iconFormat = kPngEncoding;
+size_t sinkQueueCapacity = kDefaultSinkQueueCapacity;
+int sinkDeadline = kDefaultSinkDeadline;
 
 int parse_options(int argc, char* const * argv) {
-  strncpy(display, getenv(kDisplayEnv), sizeof(display));
   while(true) {
-    const int c = getopt_long_only(argc, argv, "d:v", longopts, nullptr);
+    const int c = getopt_long_only(argc, argv, "d:b:c:l:q:o:a:w:m:h:g:f:sn:i:k:e:v", longopts, nullptr);
     switch (c) {
       case -1:
+        if (displays.empty()) {
+          const char* const display = getenv(kDisplayEnv);
+          displays.push_back(display ? display : "");
+        }
+        if (sinkSpecs.empty()) {
+          sinkSpecs.push_back(kGrowlSinkName);
+        }
         return 0;
       case 'd':
-        strncpy(display, optarg, sizeof(display));
+        displays.push_back(optarg);
+        break;
+      case 'b':
+        if (strcmp(optarg, kXcbBackendName) == 0) {
+          backend = kXcbBackend;
+        } else if (strcmp(optarg, kXlibBackendName) == 0) {
+          backend = kXlibBackend;
+        } else {
+          fprintf(stderr, kUsage, argv[0]);
+          return EX_USAGE;
+        }
+        break;
+      case 'c':
+        coalesceWindow = atoi(optarg);
+        if (coalesceWindow < 0) {
+          fprintf(stderr, kUsage, argv[0]);
+          return EX_USAGE;
+        }
+        break;
+      case 'l':
+        coalesceLimit = strtoul(optarg, nullptr, 10);
+        break;
+      case 'q':
+        queueCapacity = strtoul(optarg, nullptr, 10);
+        if (queueCapacity == 0) {
+          fprintf(stderr, kUsage, argv[0]);
+          return EX_USAGE;
+        }
+        break;
+      case 'o':
+        if (!ParseOverloadPolicy(optarg, &overloadPolicy)) {
+          fprintf(stderr, kUsage, argv[0]);
+          return EX_USAGE;
+        }
+        break;
+      case 'a':
+        priorityAging = atoi(optarg);
+        break;
+      case 'w':
+      case 'm':
+      case 'h': {
+        RateLimit* const limit = c == 'w' ? &windowLimit : c == 'm' ? &nameLimit : &hostLimit;
+        if (!ParseRateLimit(optarg, limit)) {
+          fprintf(stderr, kUsage, argv[0]);
+          return EX_USAGE;
+        }
+        break;
+      }
+      case 'g':
+        digestInterval = atoi(optarg);
+        break;
+      case 'f':
+        if (strcmp(optarg, kLanczosFilterName) == 0) {
+          iconFilter = kLanczosFilter;
+        } else if (strcmp(optarg, kBoxFilterName) == 0) {
+          iconFilter = kBoxFilter;
+        } else {
+          fprintf(stderr, kUsage, argv[0]);
+          return EX_USAGE;
+        }
+        break;
+      case 's':
+        serverScaling = true;
+        break;
+      case 'n':
+        sinkSpecs.push_back(optarg);
+        break;
+      case 'i':
+        if (strcmp(optarg, IconEncodingName(kPngEncoding)) == 0) {
+          iconFormat = kPngEncoding;
+        } else if (strcmp(optarg, IconEncodingName(kQoiEncoding)) == 0) {
+          iconFormat = kQoiEncoding;
+        } else {
+          fprintf(stderr, kUsage, argv[0]);
+          return EX_USAGE;
+        }
+        break;
+      case 'k':
+        sinkQueueCapacity = strtoul(optarg, nullptr, 10);
+        if (sinkQueueCapacity == 0) {
+          fprintf(stderr, kUsage, argv[0]);
+          return EX_USAGE;
+        }
+        break;
+      case 'e':
+        sinkDeadline = atoi(optarg);
         break;
       case 'v':
         printf(kVersionFormat, __DATE__);
@@ -200,37 +323,55 @@ int parse_options(int argc, char* const * argv) {
 }
 
 // ─────────────────────────────────────────────────────────────────────────────
-// Main function, parameter parsing and main loop.
+// Main function, sets up the displays and sinks, then runs the bell loop.
 // TODO: add some kind of clean-up exit mechanism
 // ─────────────────────────────────────────────────────────────────────────────
 
-
-
-
 int main (int argc, char* const * argv) {
-  // Sandbox API is deprecated, but we want to be a unix process.
-  char* sandbox_error = nullptr;
-  if (sandbox_init(kSBXProfileNoWriteExceptTemporary, SANDBOX_NAMED, &sandbox_error)) {
-    fprintf(stderr, kNoSandboxError, sandbox_error);
-    sandbox_free_error(sandbox_error);
-  }
-  
   const int option_status = parse_options(argc, argv);
   if (option_status){
     return option_status;
   }
 
   // Set up objective-c stuff
-  NSData* defaultIcon = getX11IconData();
-  std::unique_ptr<X11DisplayData> x11Display(X11DisplayData::GetDisplayData(argv[0], display));
-  id<GrowlNotificationProtocol> growlProxy = getGrowlProxy();
-  
-  while(true) {
-    std::unique_ptr<BellEvent> event(x11Display->NextBellEvent());
-    @autoreleasepool {
-      NSDictionary* eventDict = dictionaryForEvent(event.get(), defaultIcon);
-      [growlProxy postNotificationWithDictionary: eventDict];
+  DisplayMultiplexer x11Displays(kDefaultDisplayCacheBudget);
+  for (size_t i = 0; i < displays.size(); ++i) {
+    X11DisplayData* const display = X11DisplayData::GetDisplayData(argv[0], displays[i], backend);
+    // Displays that cannot be opened are skipped, GetDisplayData said why.
+    if (display == nullptr) {
+      continue;
     }
+    display->SetServerScaling(serverScaling);
+    x11Displays.Add(display);
+  }
+  if (x11Displays.size() == 0) {
+    fprintf(stderr, kNoDisplayError);
+    return EX_UNAVAILABLE;
+  }
+  NotificationDispatcher dispatcher(kIconCacheBudget, iconFilter, sinkQueueCapacity, sinkDeadline);
+  for (size_t i = 0; i < sinkSpecs.size(); ++i) {
+    if (sinkSpecs[i] == kGrowlSinkName) {
+      dispatcher.AddSink(new GrowlSink(getGrowlProxy(), getX11IconData()));
+      continue;
+    }
+    NotificationSink* const sink = CreateNotificationSink(sinkSpecs[i], iconFormat);
+    if (sink == nullptr) {
+      return EX_UNAVAILABLE;
+    }
+    dispatcher.AddSink(sink);
+  }
+  // Sandbox API is deprecated, but we want to be a unix process. Sinks open
+  // their files and sockets first, the sandbox only allows temporary files.
+  char* sandbox_error = nullptr;
+  if (sandbox_init(kSBXProfileNoWriteExceptTemporary, SANDBOX_NAMED, &sandbox_error)) {
+    fprintf(stderr, kNoSandboxError, sandbox_error);
+    sandbox_free_error(sandbox_error);
   }
-  return EX_OK;
+  const BellDaemonOptions options = {
+    coalesceWindow, coalesceLimit, queueCapacity, overloadPolicy, priorityAging,
+    windowLimit, nameLimit, hostLimit, digestInterval };
+  RunBellDaemon(&x11Displays, options, &dispatcher);
+  // A supervisor can start the daemon again once the displays are back.
+  fprintf(stderr, kAllDisplaysLostError);
+  return EX_UNAVAILABLE;
 }